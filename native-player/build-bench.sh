@@ -0,0 +1,12 @@
+#!/bin/bash
+
+mkdir -p ../bin
+
+g++ shanat-bench/main.cpp shanat-live/hot_file.cpp shanat-live/shader_sources.cpp shanat-shared/arg_parse.cpp \
+    shanat-shared/fps.cpp shanat-shared/frame_stats.cpp shanat-shared/horrors.cpp \
+    shanat-shared/hash.cpp shanat-shared/headless.cpp shanat-shared/horrors_args.cpp shanat-shared/json.cpp \
+    shanat-shared/profiler.cpp shanat-shared/render_state.cpp shanat-shared/trace.cpp \
+    -o ../bin/shanat-bench \
+    -std=c++11 \
+    -I/usr/include/drm -I/usr/include/libdrm \
+    -lEGL -lGLESv2 -lgbm -ldrm -lpthread -lm
@@ -2,10 +2,21 @@
 
 mkdir -p ../bin
 
-g++ shanat-live/main.cpp shanat-live/hot_file.cpp shanat-live/arg_parse.cpp \
-    shanat-shared/fps.cpp shanat-shared/geo.cpp shanat-shared/horrors.cpp \
+# NEON on the Pi's 32-bit OS, whose compiler targets ARMv6 by default
+ARCH_FLAGS=""
+if [ "$(uname -m)" = "armv7l" ]; then ARCH_FLAGS="-march=armv8-a -mfpu=neon-fp-armv8 -mfloat-abi=hard"; fi
+# ALSA capture for --audio alsa:DEVICE: SHANAT_ALSA=1 ./build-live.sh, with libasound2-dev installed
+ALSA_FLAGS=""
+if [ -n "$SHANAT_ALSA" ]; then ALSA_FLAGS="-DSHANAT_ALSA -lasound"; fi
+
+g++ shanat-live/main.cpp shanat-live/hot_file.cpp shanat-live/shader_worker.cpp shanat-live/render_graph.cpp shanat-live/playlist.cpp shanat-live/shader_sources.cpp shanat-live/control_server.cpp shanat-live/audio_input.cpp shanat-shared/arg_parse.cpp \
+    shanat-shared/fft.cpp shanat-shared/fps.cpp shanat-shared/frame_stats.cpp shanat-shared/geo.cpp shanat-shared/hash.cpp shanat-shared/horrors.cpp \
+    shanat-shared/headless.cpp shanat-shared/horrors_args.cpp shanat-shared/json.cpp shanat-shared/offline.cpp \
+    shanat-shared/adaptive_res.cpp shanat-shared/gpu_fences.cpp shanat-shared/profiler.cpp shanat-shared/program_cache.cpp shanat-shared/render_state.cpp shanat-shared/trace.cpp \
     -o ../bin/shanat-live \
-    -std=c++11 \
+    -std=c++11 $ARCH_FLAGS \
     -I/usr/include/drm -I/usr/include/libdrm \
-    -lEGL -lGLESv2 -lgbm -ldrm -lpthread -lm
+    -lEGL -lGLESv2 -lgbm -ldrm -lpthread -lm -lrt $ALSA_FLAGS
+
+gcc shanat-uniform/main.c -o ../bin/shanat-uniform -std=c99 -Wall -lrt
 
@@ -0,0 +1,18 @@
+#!/bin/bash
+
+mkdir -p ../bin
+
+# NEON on the Pi's 32-bit OS, whose compiler targets ARMv6 by default
+ARCH_FLAGS=""
+if [ "$(uname -m)" = "armv7l" ]; then ARCH_FLAGS="-march=armv8-a -mfpu=neon-fp-armv8 -mfloat-abi=hard"; fi
+# Benchmarks mean little unoptimized; OPT_FLAGS="-O2 -DSHANAT_NO_SIMD" measures the scalar paths
+OPT_FLAGS=${OPT_FLAGS:--O2}
+
+./shader-includes.sh shanat-sketches/lissaj
+
+g++ shanat-microbench/main.cpp shanat-sketches/lissaj/lissaj.cpp shanat-live/hot_file.cpp \
+    shanat-shared/arg_parse.cpp shanat-shared/fps.cpp shanat-shared/frame_stats.cpp shanat-shared/geo.cpp \
+    shanat-shared/hash.cpp shanat-shared/json.cpp shanat-shared/profiler.cpp shanat-shared/trace.cpp \
+    -o ../bin/shanat-microbench \
+    -std=c++11 $OPT_FLAGS $ARCH_FLAGS \
+    -lpthread -lm
@@ -2,12 +2,18 @@
 
 mkdir -p ../bin
 
+# NEON on the Pi's 32-bit OS, whose compiler targets ARMv6 by default
+ARCH_FLAGS=""
+if [ "$(uname -m)" = "armv7l" ]; then ARCH_FLAGS="-march=armv8-a -mfpu=neon-fp-armv8 -mfloat-abi=hard"; fi
+
 ./shader-includes.sh shanat-sketches/lissaj
 
-g++ shanat-sketches/main.cpp shanat-sketches/lissaj/lissaj.cpp \
-    shanat-shared/fps.cpp shanat-shared/geo.cpp shanat-shared/horrors.cpp \
+g++ shanat-sketches/main.cpp shanat-sketches/lissaj/lissaj.cpp shanat-shared/arg_parse.cpp \
+    shanat-shared/fps.cpp shanat-shared/frame_stats.cpp shanat-shared/geo.cpp shanat-shared/horrors.cpp \
+    shanat-shared/headless.cpp shanat-shared/horrors_args.cpp shanat-shared/offline.cpp \
+    shanat-shared/gpu_fences.cpp shanat-shared/profiler.cpp shanat-shared/program_cache.cpp shanat-shared/render_state.cpp shanat-shared/trace.cpp \
     -o ../bin/shanat-sketches \
-    -std=c++11 \
+    -std=c++11 $ARCH_FLAGS \
     -I/usr/include/drm -I/usr/include/libdrm \
     -lEGL -lGLESv2 -lgbm -ldrm -lpthread -lm
 
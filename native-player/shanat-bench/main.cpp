@@ -0,0 +1,515 @@
+#include "../shanat-live/shader_sources.h"
+#include "../shanat-shared/arg_parse.h"
+#include "../shanat-shared/fps.h"
+#include "../shanat-shared/horrors.h"
+#include "../shanat-shared/horrors_args.h"
+#include "../shanat-shared/json.h"
+#include "../shanat-shared/render_state.h"
+
+#include <algorithm>
+#include <cctype>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+static HorrorsOptions horrors_opts;
+static std::vector<std::string> corpus;
+static int target_fps;
+static int warmup_frames;
+static int bench_frames;
+static std::string out_file;
+static std::string baseline_file;
+static float threshold_pct;
+
+static bool running = true;
+
+// Frame-time increases smaller than this are noise, whatever the percentage
+static const uint32_t frame_slack_usec = 500;
+// Same for compile plus link time, which varies a lot more from run to run
+static const long build_slack_usec = 5000;
+
+struct BenchResult
+{
+    std::string file;
+    bool ok = false;
+    std::string error;
+    long compile_usec = 0;
+    long link_usec = 0;
+    // Includes whatever compilation the driver defers to the first draw
+    long first_frame_usec = 0;
+    uint32_t p50 = 0;
+    uint32_t p95 = 0;
+    uint32_t p99 = 0;
+    uint32_t max = 0;
+    double mean = 0;
+};
+
+static void sighandler(int)
+{
+    running = false;
+}
+
+static bool has_shader_ext(const std::string &name)
+{
+    size_t dot = name.rfind('.');
+    if (dot == std::string::npos) return false;
+    std::string ext = name.substr(dot);
+    return ext == ".glsl" || ext == ".frag";
+}
+
+// Fragment shaders under a directory, recursively, in a stable order
+static void collect_shaders(const std::string &path, std::vector<std::string> &files)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) return;
+    if (!S_ISDIR(st.st_mode))
+    {
+        files.push_back(path);
+        return;
+    }
+
+    DIR *dir = opendir(path.c_str());
+    if (!dir) return;
+    std::vector<std::string> entries;
+    while (dirent *ent = readdir(dir))
+    {
+        if (ent->d_name[0] == '.' || strcmp(ent->d_name, "node_modules") == 0) continue;
+        entries.push_back(ent->d_name);
+    }
+    closedir(dir);
+    std::sort(entries.begin(), entries.end());
+
+    for (auto &name : entries)
+    {
+        std::string child = path + (path.back() == '/' ? "" : "/") + name;
+        if (stat(child.c_str(), &st) != 0) continue;
+        if (S_ISDIR(st.st_mode)) collect_shaders(child, files);
+        else if (has_shader_ext(name)) files.push_back(child);
+    }
+}
+
+static void parse_args(int argc, const char *argv[])
+{
+    auto parser = ArgumentParser("shanat-bench");
+    parser.add_argument("help", "--help", "", "Displays this help message");
+    // Nothing is ever presented, so don't take over the display unless asked to
+    add_horrors_arguments(parser, BACKEND_HEADLESS);
+    parser.add_argument("corpus", "--corpus", "", "Fragment shader file, or directory searched for *.glsl and *.frag", STORE);
+    parser.add_argument("fps", "--fps", "", "Frame budget as target FPS (default: 25)", STORE, "25");
+    parser.add_argument("warmup", "--warmup", "", "Frames rendered before measuring (default: 25)", STORE, "25");
+    parser.add_argument("frames", "--frames", "", "Frames measured per shader (default: 250)", STORE, "250");
+    parser.add_argument("out", "--out", "", "Write results as JSON to this file", STORE);
+    parser.add_argument("baseline", "--baseline", "", "Compare against JSON results from an earlier run", STORE);
+    parser.add_argument("threshold", "--threshold", "", "Percent slowdown counted as a regression (default: 10)", STORE, "10");
+
+    bool success = parser.parse(argv, argc, stdout);
+    if (!success || parser.get("help").is_set)
+    {
+        parser.print_usage(stdout);
+        exit(success ? 0 : 1);
+    }
+
+    bool ok = read_horrors_arguments(parser, horrors_opts);
+
+    auto corpus_val = parser.get("corpus");
+    if (corpus_val.is_set) collect_shaders(corpus_val.value, corpus);
+    if (corpus.empty())
+    {
+        fprintf(stderr, "Corpus with at least one fragment shader is required\n");
+        ok = false;
+    }
+
+    auto fps_val = parser.get("fps").value;
+    target_fps = atoi(fps_val.c_str());
+    if (target_fps <= 0)
+    {
+        fprintf(stderr, "FPS value must be positive integer; got '%s'\n", fps_val.c_str());
+        ok = false;
+    }
+
+    warmup_frames = atoi(parser.get("warmup").value.c_str());
+    bench_frames = atoi(parser.get("frames").value.c_str());
+    if (warmup_frames < 1 || bench_frames < 1)
+    {
+        fprintf(stderr, "Warmup and measured frame counts must be positive\n");
+        ok = false;
+    }
+
+    threshold_pct = atof(parser.get("threshold").value.c_str());
+    if (threshold_pct <= 0)
+    {
+        fprintf(stderr, "Threshold must be positive; got '%s'\n", parser.get("threshold").value.c_str());
+        ok = false;
+    }
+
+    if (parser.get("out").is_set) out_file = parser.get("out").value;
+    if (parser.get("baseline").is_set) baseline_file = parser.get("baseline").value;
+
+    if (!ok)
+    {
+        parser.print_usage(stdout);
+        exit(1);
+    }
+}
+
+static void main_inner();
+static bool compare_baseline(const std::vector<BenchResult> &results);
+
+static const char *vert_sweep_glsl = R"(
+#version 310 es
+in vec2 a_pos;
+void main() {
+    gl_Position = vec4(a_pos, 0.0, 1.0);
+}
+)";
+
+static const char *vert_sweep_glsl_100 = R"(
+attribute vec2 a_pos;
+void main() {
+    gl_Position = vec4(a_pos, 0.0, 1.0);
+}
+)";
+
+int main(int argc, const char *argv[])
+{
+    parse_args(argc, argv);
+
+    signal(SIGINT, sighandler);
+    signal(SIGTERM, sighandler);
+
+    main_inner();
+    return 0;
+}
+
+static std::string shader_log(GLuint obj, bool is_program)
+{
+    GLint len = 0;
+    if (is_program) glGetProgramiv(obj, GL_INFO_LOG_LENGTH, &len);
+    else glGetShaderiv(obj, GL_INFO_LOG_LENGTH, &len);
+    std::string log(len ? len : 1, '\0');
+    if (is_program) glGetProgramInfoLog(obj, len, nullptr, &log[0]);
+    else glGetShaderInfoLog(obj, len, nullptr, &log[0]);
+    log.resize(strlen(log.c_str()));
+    while (!log.empty() && isspace((unsigned char)log.back())) log.pop_back();
+    return log;
+}
+
+// Compiles and checks status right away, so the driver can't hide the work elsewhere
+static GLuint compile_timed(GLenum type, const char *src, long &usec, std::string &error)
+{
+    int64_t t0 = monotonic_usec();
+    GLuint s = glCreateShader(type);
+    glShaderSource(s, 1, &src, nullptr);
+    glCompileShader(s);
+    GLint ok = 0;
+    glGetShaderiv(s, GL_COMPILE_STATUS, &ok);
+    usec = monotonic_usec() - t0;
+    if (ok) return s;
+    error = shader_log(s, false);
+    glDeleteShader(s);
+    return 0;
+}
+
+static GLuint build_program(const std::string &frag_src, BenchResult &res)
+{
+    // GLSL ES 3.x needs the matching vertex shader
+    size_t pos = frag_src.find("#version");
+    bool es3 = pos != std::string::npos && atoi(frag_src.c_str() + pos + 8) >= 300;
+
+    long vs_usec = 0;
+    GLuint vs = compile_timed(GL_VERTEX_SHADER, es3 ? vert_sweep_glsl : vert_sweep_glsl_100, vs_usec, res.error);
+    if (vs == 0) die("glCompileShader (vertex)");
+    GLuint fs = compile_timed(GL_FRAGMENT_SHADER, frag_src.c_str(), res.compile_usec, res.error);
+    res.compile_usec += vs_usec;
+    if (fs == 0)
+    {
+        glDeleteShader(vs);
+        return 0;
+    }
+
+    int64_t t0 = monotonic_usec();
+    GLuint prog = glCreateProgram();
+    glAttachShader(prog, vs);
+    glAttachShader(prog, fs);
+    glBindAttribLocation(prog, 0, "a_pos");
+    glLinkProgram(prog);
+    GLint ok = 0;
+    glGetProgramiv(prog, GL_LINK_STATUS, &ok);
+    res.link_usec = monotonic_usec() - t0;
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    if (ok) return prog;
+    res.error = shader_log(prog, true);
+    glDeleteProgram(prog);
+    return 0;
+}
+
+// Time from the first draw call until the GPU is done with the frame
+static uint32_t render_frame(ProgramUniforms &uniforms, int time_ix, float time)
+{
+    int64_t t0 = monotonic_usec();
+    uniforms.set(time_ix, time);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glFinish();
+    return monotonic_usec() - t0;
+}
+
+static void bench_shader(const std::string &file, GLuint vbo, BenchResult &res)
+{
+    res.file = file;
+    // Includes expanded the way shanat-live does, so we compile exactly what it would
+    ShaderSources sources(false);
+    std::string frag_src;
+    std::vector<std::string> deps;
+    if (!sources.expand(file, frag_src, deps, res.error)) return;
+
+    GLuint prog = build_program(frag_src, res);
+    if (prog == 0)
+    {
+        res.error = sources.annotate(res.error);
+        return;
+    }
+
+    ProgramUniforms uniforms;
+    uniforms.reset(prog);
+    render_state.use_program(prog);
+    render_state.vertex_attrib(0, vbo, 2, GL_FLOAT);
+    uniforms.set(uniforms.find("resolution"), (float)surface_width, (float)surface_height);
+    uniforms.set(uniforms.find("render_scale"), 1.0f);
+    int time_ix = uniforms.find("time");
+
+    // Fixed timestep at the target rate, so runs see the same frames
+    const float dt = 1.0f / target_fps;
+    int frame = 0;
+    for (; frame < warmup_frames && running; ++frame)
+    {
+        uint32_t usec = render_frame(uniforms, time_ix, frame * dt);
+        if (frame == 0) res.first_frame_usec = usec;
+    }
+
+    std::vector<uint32_t> samples;
+    samples.reserve(bench_frames);
+    double sum = 0;
+    for (int i = 0; i < bench_frames && running; ++i, ++frame)
+    {
+        samples.push_back(render_frame(uniforms, time_ix, frame * dt));
+        sum += samples.back();
+    }
+    render_state.delete_program(prog);
+
+    if (samples.empty())
+    {
+        res.error = "Interrupted";
+        return;
+    }
+    std::sort(samples.begin(), samples.end());
+    auto pct = [&samples](double q) { return samples[(size_t)(q * (samples.size() - 1) + 0.5)]; };
+    res.p50 = pct(0.5);
+    res.p95 = pct(0.95);
+    res.p99 = pct(0.99);
+    res.max = samples.back();
+    res.mean = sum / samples.size();
+    res.ok = true;
+}
+
+// One shader per line, so compare mode can read it back without a JSON parser
+static bool write_json(const std::string &path, const std::vector<BenchResult> &results)
+{
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    fprintf(f, "{\"renderer\":%s,\"width\":%u,\"height\":%u,\"fps\":%d,\"warmup\":%d,\"frames\":%d,\"budget_usec\":%d,\n",
+            json_string((const char *)glGetString(GL_RENDERER)).c_str(), surface_width, surface_height,
+            target_fps, warmup_frames, bench_frames, 1000000 / target_fps);
+    fprintf(f, "\"shaders\":[\n");
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const BenchResult &r = results[i];
+        fprintf(f, "{\"file\":%s,\"ok\":%s", json_string(r.file).c_str(), r.ok ? "true" : "false");
+        if (r.ok)
+        {
+            fprintf(f, ",\"compile_usec\":%ld,\"link_usec\":%ld,\"first_frame_usec\":%ld,"
+                       "\"frame_usec\":{\"p50\":%u,\"p95\":%u,\"p99\":%u,\"max\":%u,\"mean\":%.1f},\"fits_budget\":%s}",
+                    r.compile_usec, r.link_usec, r.first_frame_usec, r.p50, r.p95, r.p99, r.max, r.mean,
+                    r.p95 <= 1000000u / target_fps ? "true" : "false");
+        }
+        else fprintf(f, ",\"error\":%s}", json_string(r.error).c_str());
+        fprintf(f, "%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "]}\n");
+    return fclose(f) == 0;
+}
+
+static void main_inner()
+{
+    // Set up graphics; nothing is presented, frames only need to finish on the GPU
+    init_horrors(horrors_opts);
+    printf("Renderer: %s, %ux%u, budget %.2f msec\n", glGetString(GL_RENDERER),
+           surface_width, surface_height, 1000.0 / target_fps);
+
+    render_state.set_enabled(GL_BLEND, true);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    render_state.set_enabled(GL_DEPTH_TEST, true);
+    glDepthFunc(GL_LESS);
+    glClearColor(0, 0, 0, 1);
+    render_state.bind_framebuffer(default_fbo);
+    render_state.viewport(0, 0, surface_width, surface_height);
+
+    static const GLfloat sweep_verts[] = {
+        -1, -1,
+        1, -1,
+        -1, 1,
+        -1, 1,
+        1, -1,
+        1, 1};
+    GLuint vbo;
+    glGenBuffers(1, &vbo);
+    render_state.bind_array_buffer(vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(sweep_verts), sweep_verts, GL_STATIC_DRAW);
+
+    printf("%-48s %9s %9s %9s %9s %9s\n", "shader", "compile", "link", "p50", "p95", "max");
+    std::vector<BenchResult> results;
+    for (size_t i = 0; i < corpus.size() && running; ++i)
+    {
+        results.push_back(BenchResult());
+        BenchResult &r = results.back();
+        bench_shader(corpus[i], vbo, r);
+        if (!r.ok)
+        {
+            printf("%-48s FAILED: %s\n", r.file.c_str(), r.error.c_str());
+            continue;
+        }
+        printf("%-48s %9.2f %9.2f %9.2f %9.2f %9.2f%s\n", r.file.c_str(), r.compile_usec / 1000.0, r.link_usec / 1000.0,
+               r.p50 / 1000.0, r.p95 / 1000.0, r.max / 1000.0, r.p95 > 1000000u / target_fps ? "  OVER BUDGET" : "");
+    }
+
+    if (!out_file.empty() && !write_json(out_file, results))
+    {
+        fprintf(stderr, "Failed to write results to '%s'\n", out_file.c_str());
+        exit_with_cleanup(1);
+    }
+
+    bool regressed = !baseline_file.empty() && compare_baseline(results);
+
+    render_state.delete_buffer(vbo);
+    cleanup_horrors();
+    if (regressed) exit(2);
+}
+
+// Number after "key": in a line, or -1
+static double json_number(const char *line, const char *key)
+{
+    const char *p = strstr(line, key);
+    if (!p) return -1;
+    return atof(p + strlen(key));
+}
+
+// Baseline must be a file this tool wrote: one shader object per line
+static bool read_baseline(const std::string &path, std::vector<BenchResult> &baseline, std::string &renderer)
+{
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    char line[4096];
+    while (fgets(line, sizeof(line), f))
+    {
+        const char *p = strstr(line, "\"renderer\":\"");
+        if (p)
+        {
+            p += strlen("\"renderer\":\"");
+            const char *end = strchr(p, '"');
+            if (end) renderer.assign(p, end - p);
+            continue;
+        }
+        p = strstr(line, "{\"file\":\"");
+        if (!p) continue;
+
+        BenchResult r;
+        for (p += strlen("{\"file\":\""); *p && *p != '"'; ++p)
+        {
+            if (*p == '\\' && p[1]) ++p;
+            r.file += *p;
+        }
+        r.ok = strstr(line, "\"ok\":true") != nullptr;
+        r.compile_usec = json_number(line, "\"compile_usec\":");
+        r.link_usec = json_number(line, "\"link_usec\":");
+        r.p50 = json_number(line, "\"p50\":");
+        r.p95 = json_number(line, "\"p95\":");
+        baseline.push_back(r);
+    }
+    fclose(f);
+    return true;
+}
+
+static bool slower(double now, double then, double slack)
+{
+    return now - then > slack && now > then * (1 + threshold_pct / 100);
+}
+
+// Prints how each shader moved against the baseline; true if anything regressed
+static bool compare_baseline(const std::vector<BenchResult> &results)
+{
+    std::vector<BenchResult> baseline;
+    std::string renderer;
+    if (!read_baseline(baseline_file, baseline, renderer))
+    {
+        fprintf(stderr, "Cannot read baseline '%s'\n", baseline_file.c_str());
+        return true;
+    }
+    if (renderer != (const char *)glGetString(GL_RENDERER))
+        printf("Warning: baseline is from a different renderer: %s\n", renderer.c_str());
+
+    printf("\nAgainst %s (threshold %.0f%%):\n", baseline_file.c_str(), threshold_pct);
+    int regressions = 0;
+    for (auto &now : results)
+    {
+        auto then = std::find_if(baseline.begin(), baseline.end(), [&now](const BenchResult &b) { return b.file == now.file; });
+        if (then == baseline.end())
+        {
+            printf("  NEW        %s\n", now.file.c_str());
+            continue;
+        }
+
+        std::string why;
+        if (then->ok && !now.ok) why = "now fails to build";
+        else if (now.ok && then->ok)
+        {
+            char buf[128];
+            if (slower(now.p95, then->p95, frame_slack_usec))
+            {
+                snprintf(buf, sizeof(buf), "p95 %.2f -> %.2f msec", then->p95 / 1000.0, now.p95 / 1000.0);
+                why = buf;
+            }
+            else if (slower(now.p50, then->p50, frame_slack_usec))
+            {
+                snprintf(buf, sizeof(buf), "p50 %.2f -> %.2f msec", then->p50 / 1000.0, now.p50 / 1000.0);
+                why = buf;
+            }
+            else if (slower(now.compile_usec + now.link_usec, then->compile_usec + then->link_usec, build_slack_usec))
+            {
+                snprintf(buf, sizeof(buf), "build %.2f -> %.2f msec", (then->compile_usec + then->link_usec) / 1000.0,
+                         (now.compile_usec + now.link_usec) / 1000.0);
+                why = buf;
+            }
+        }
+
+        if (why.empty()) printf("  ok         %s\n", now.file.c_str());
+        else
+        {
+            printf("  REGRESSION %s: %s\n", now.file.c_str(), why.c_str());
+            ++regressions;
+        }
+    }
+    for (auto &then : baseline)
+    {
+        bool found = std::any_of(results.begin(), results.end(), [&then](const BenchResult &r) { return r.file == then.file; });
+        if (!found) printf("  MISSING    %s\n", then.file.c_str());
+    }
+
+    printf("%d regression%s\n", regressions, regressions == 1 ? "" : "s");
+    return regressions > 0;
+}
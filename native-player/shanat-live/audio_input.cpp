@@ -0,0 +1,335 @@
+#include "audio_input.h"
+#include "../shanat-shared/fps.h"
+#include "../shanat-shared/trace.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef SHANAT_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+static const char *alsa_prefix = "alsa:";
+// Lowest frequency on the spectrum texture
+static const float min_freq = 20;
+// Level range mapped to 0..1
+static const float floor_db = -70;
+// Pause before looking again at a FIFO whose writer went away
+static const int fifo_retry_msec = 100;
+
+AudioInput::AudioInput(const std::string &source, float smoothing)
+    : source(source)
+    , smoothing(smoothing)
+    , running(true)
+    , fft(fft_size)
+    , history(fft_size, 0)
+    , mags(fft_size / 2)
+    , smoothed(AudioFrame::spectrum_size, 0)
+    , latest(2)
+{
+    memset(slots, 0, sizeof(slots));
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake_fd < 0)
+    {
+        fprintf(stderr, "Failed to create eventfd for audio input\n");
+        exit(-1);
+    }
+    open_source();
+
+    if (pthread_create(&thread, nullptr, analysis_fun, this) != 0)
+    {
+        fprintf(stderr, "Failed to start audio analysis thread\n");
+        exit(-1);
+    }
+}
+
+AudioInput::~AudioInput()
+{
+    running = false;
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) != sizeof(one)) fprintf(stderr, "Failed to wake audio thread\n");
+    pthread_join(thread, nullptr);
+#ifdef SHANAT_ALSA
+    if (pcm) snd_pcm_close((snd_pcm_t *)pcm);
+#endif
+    if (fd >= 0) close(fd);
+    close(wake_fd);
+}
+
+void AudioInput::open_source()
+{
+    if (source.compare(0, strlen(alsa_prefix), alsa_prefix) == 0)
+    {
+        kind = KIND_ALSA;
+#ifdef SHANAT_ALSA
+        std::string device = source.substr(strlen(alsa_prefix));
+        snd_pcm_t *handle;
+        int err = snd_pcm_open(&handle, device.c_str(), SND_PCM_STREAM_CAPTURE, 0);
+        // Mono at 44.1 kHz; the plug layer converts whatever the device does, within 50 ms of latency
+        if (err == 0) err = snd_pcm_set_params(handle, SND_PCM_FORMAT_S16_LE, SND_PCM_ACCESS_RW_INTERLEAVED, 1, 44100, 1, 50000);
+        if (err < 0)
+        {
+            fprintf(stderr, "Cannot open ALSA capture device '%s': %s\n", device.c_str(), snd_strerror(err));
+            exit(-1);
+        }
+        pcm = handle;
+        rate = 44100;
+        channels = 1;
+        return;
+#else
+        fprintf(stderr, "Built without ALSA; rebuild with SHANAT_ALSA=1 or use a WAV file or FIFO\n");
+        exit(-1);
+#endif
+    }
+
+    // Non-blocking, so opening a FIFO doesn't wait for a writer and reads never hang shutdown
+    fd = open(source.c_str(), O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        fprintf(stderr, "Cannot open audio source '%s'\n", source.c_str());
+        exit(-1);
+    }
+    kind = S_ISFIFO(st.st_mode) ? KIND_FIFO : KIND_FILE;
+    if (kind == KIND_FILE && !read_wav_header())
+    {
+        fprintf(stderr, "Audio file must be 16-bit PCM WAV: '%s'\n", source.c_str());
+        exit(-1);
+    }
+}
+
+// RIFF header up to the start of the sample data; for a FIFO, false also means raw samples
+bool AudioInput::read_wav_header()
+{
+    char riff[12];
+    if (!read_fd(riff, 12) || memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) return false;
+    bool have_fmt = false;
+    uint32_t data_size = 0;
+    while (true)
+    {
+        unsigned char chunk[8];
+        if (!read_fd(chunk, 8)) return false;
+        uint32_t size = chunk[4] | chunk[5] << 8 | chunk[6] << 16 | (uint32_t)chunk[7] << 24;
+        if (memcmp(chunk, "data", 4) == 0)
+        {
+            data_size = size;
+            break;
+        }
+        // Chunks are padded to even sizes
+        std::vector<unsigned char> body(size + (size & 1));
+        if (!body.empty() && !read_fd(&body[0], body.size())) return false;
+        if (memcmp(chunk, "fmt ", 4) != 0 || size < 16) continue;
+        int format = body[0] | body[1] << 8;
+        int bits = body[14] | body[15] << 8;
+        channels = body[2] | body[3] << 8;
+        rate = body[4] | body[5] << 8 | body[6] << 16 | body[7] << 24;
+        if (format != 1 || bits != 16 || channels < 1 || rate <= 0) return false;
+        have_fmt = true;
+    }
+    // A FIFO's length is bogus: streams don't know it when they write the header
+    if (kind != KIND_FILE || !have_fmt) return have_fmt;
+
+    // Stop at the end of the data chunk, so trailing LIST or id3 chunks aren't played as
+    // samples; a length past the end of the file means one that never got its header fixed
+    struct stat st;
+    data_offset = lseek(fd, 0, SEEK_CUR);
+    off_t file_end = fstat(fd, &st) == 0 ? st.st_size : data_offset;
+    data_end = data_size > 0 && data_offset + (off_t)data_size <= file_end ? data_offset + data_size : file_end;
+    data_end -= (data_end - data_offset) % (2 * channels);
+    return data_end > data_offset;
+}
+
+bool AudioInput::wait_readable(int timeout_msec)
+{
+    pollfd fds[2] = {};
+    fds[0].fd = wake_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = fd;
+    fds[1].events = POLLIN;
+    int n = poll(fds, fd >= 0 ? 2 : 1, timeout_msec);
+    return n > 0 && !fds[0].revents && fds[1].revents;
+}
+
+// All of len, or false at end of file, on error, or when stopping
+bool AudioInput::read_fd(void *buf, size_t len)
+{
+    char *p = (char *)buf;
+    at_eof = false;
+    while (len > 0 && running)
+    {
+        ssize_t n = read(fd, p, len);
+        if (n > 0)
+        {
+            p += n;
+            len -= n;
+        }
+        else if (n == 0)
+        {
+            at_eof = true;
+            return false;
+        }
+        else if (errno == EAGAIN) wait_readable(-1);
+        else if (errno != EINTR) return false;
+    }
+    return len == 0;
+}
+
+bool AudioInput::read_samples(float *out, int count)
+{
+    pcm_buf.resize(count * channels);
+    if (kind == KIND_ALSA)
+    {
+#ifdef SHANAT_ALSA
+        snd_pcm_t *handle = (snd_pcm_t *)pcm;
+        for (int got = 0; got < count;)
+        {
+            if (!running) return false;
+            if (snd_pcm_wait(handle, 100) == 0) continue;
+            snd_pcm_sframes_t n = snd_pcm_readi(handle, &pcm_buf[got * channels], count - got);
+            // Overrun: we were too slow, but the next hop is as good as this one
+            if (n < 0) n = snd_pcm_recover(handle, n, 1);
+            if (n < 0) return false;
+            got += n;
+        }
+#endif
+    }
+    else if (kind == KIND_FILE)
+    {
+        // Loop: back to the first sample at the end of the data chunk
+        char *p = (char *)&pcm_buf[0];
+        size_t left = pcm_buf.size() * 2;
+        while (left > 0)
+        {
+            off_t pos = lseek(fd, 0, SEEK_CUR);
+            if (pos >= data_end) pos = lseek(fd, data_offset, SEEK_SET);
+            if (pos < 0) return false;
+            size_t n = left < (size_t)(data_end - pos) ? left : (size_t)(data_end - pos);
+            if (!read_fd(p, n)) return false;
+            p += n;
+            left -= n;
+        }
+    }
+    else if (!read_fd(&pcm_buf[0], pcm_buf.size() * 2)) return false;
+
+    for (int i = 0; i < count; ++i)
+    {
+        int sum = 0;
+        for (int c = 0; c < channels; ++c) sum += pcm_buf[i * channels + c];
+        out[i] = sum / (32768.0f * channels);
+    }
+    return true;
+}
+
+void *AudioInput::analysis_fun(void *arg)
+{
+    AudioInput &ai = *(AudioInput *)arg;
+    trace_thread_name("audio");
+
+    // A WAV file plays in real time; the other sources pace themselves
+    int64_t start_usec = monotonic_usec();
+    int64_t played = 0;
+    bool fifo_header_checked = false;
+    while (ai.running)
+    {
+        if (ai.kind == KIND_FIFO && !fifo_header_checked)
+        {
+            // arecord and ffmpeg write a header with a bogus length; anything else is raw samples
+            bool wav = ai.read_wav_header();
+            fifo_header_checked = wav || !ai.at_eof;
+            if (!wav)
+            {
+                ai.rate = 44100;
+                ai.channels = 2;
+            }
+        }
+
+        bool waiting = ai.kind == KIND_FIFO && !fifo_header_checked;
+        if (waiting || !ai.read_samples(&ai.history[fft_size - hop_size], hop_size))
+        {
+            if (ai.kind != KIND_FIFO || !ai.running) break;
+            // No writer yet, or it went away: wait for the next one, which starts with a header again
+            fifo_header_checked = false;
+            pollfd wake = {ai.wake_fd, POLLIN, 0};
+            poll(&wake, 1, fifo_retry_msec);
+            continue;
+        }
+        ai.analyse();
+        memmove(&ai.history[0], &ai.history[hop_size], (fft_size - hop_size) * sizeof(float));
+
+        if (ai.kind != KIND_FILE) continue;
+        played += hop_size;
+        int64_t wait_usec = start_usec + played * 1000000 / ai.rate - monotonic_usec();
+        pollfd wake = {ai.wake_fd, POLLIN, 0};
+        if (wait_usec > 0) poll(&wake, 1, (int)((wait_usec + 999) / 1000));
+    }
+    if (ai.running) fprintf(stderr, "Audio input '%s' ended\n", ai.source.c_str());
+    return nullptr;
+}
+
+// Log-spaced texels; each covers at least one bin, so the low end repeats bins
+void AudioInput::map_texels()
+{
+    const int n = AudioFrame::spectrum_size;
+    const int bins = fft_size / 2;
+    const float bin_hz = (float)rate / fft_size;
+    const float nyquist = rate / 2.0f;
+    texel_bins.resize(n + 1);
+    for (int t = 0; t <= n; ++t)
+    {
+        int bin = (int)(min_freq * powf(nyquist / min_freq, (float)t / n) / bin_hz);
+        texel_bins[t] = bin < 1 ? 1 : bin > bins ? bins : bin;
+    }
+    texel_bins_rate = rate;
+}
+
+void AudioInput::analyse()
+{
+    TRACE_SCOPE("audio_analyse");
+    if (texel_bins_rate != rate) map_texels();
+    fft.magnitudes(&history[0], &mags[0]);
+
+    AudioFrame frame;
+    const int n = AudioFrame::spectrum_size;
+    for (int t = 0; t < n; ++t)
+    {
+        int lo = texel_bins[t];
+        int hi = texel_bins[t + 1] > lo ? texel_bins[t + 1] : lo + 1;
+        if (hi > fft_size / 2) lo = (hi = fft_size / 2) - 1;
+        float peak = 0;
+        for (int b = lo; b < hi; ++b) peak = mags[b] > peak ? mags[b] : peak;
+        float level = (20 * log10f(peak > 1e-7f ? peak : 1e-7f) - floor_db) / -floor_db;
+        level = level < 0 ? 0 : level > 1 ? 1 : level;
+        smoothed[t] = smoothed[t] * smoothing + level * (1 - smoothing);
+        frame.spectrum[t] = (uint8_t)(smoothed[t] * 255 + 0.5f);
+    }
+    // Four equal stretches of the log scale: bass, low mids, high mids, treble
+    for (int b = 0; b < 4; ++b)
+    {
+        float sum = 0;
+        for (int t = b * n / 4; t < (b + 1) * n / 4; ++t) sum += smoothed[t];
+        frame.bands[b] = sum / (n / 4);
+    }
+    frame.serial = ++serial;
+    publish(frame);
+}
+
+void AudioInput::publish(const AudioFrame &frame)
+{
+    slots[write_ix] = frame;
+    write_ix = latest.exchange(write_ix | fresh_bit, std::memory_order_acq_rel) & ~fresh_bit;
+}
+
+const AudioFrame *AudioInput::take_latest()
+{
+    if (!(latest.load(std::memory_order_acquire) & fresh_bit)) return nullptr;
+    read_ix = latest.exchange(read_ix, std::memory_order_acq_rel) & ~fresh_bit;
+    return &slots[read_ix];
+}
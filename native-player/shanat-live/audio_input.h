@@ -0,0 +1,99 @@
+#ifndef AUDIO_INPUT_H
+#define AUDIO_INPUT_H
+
+#include "../shanat-shared/fft.h"
+
+#include <atomic>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// One analysis result, as the render thread sees it
+struct AudioFrame
+{
+    static const int spectrum_size = 256;
+    // Bass to treble, 0..1, for uniform float fft[4]
+    float bands[4];
+    // Log-spaced from 20 Hz to Nyquist, 0..255 for -70..0 dB; one row of a luminance texture
+    uint8_t spectrum[spectrum_size];
+    // Counts analyses, so the render thread can tell a new one from the last
+    uint64_t serial;
+};
+
+// Analyses audio on a thread of its own and keeps the latest result for the render thread,
+// which never waits for it: results pass through a triple buffer, so neither side blocks.
+//
+// Sources:
+//     file.wav       16-bit PCM, played back in real time and looped
+//     /path/to/fifo  WAV from e.g. `arecord -f cd`, or raw 16-bit stereo at 44.1 kHz
+//     alsa:DEVICE    ALSA capture, e.g. alsa:default; needs a build with SHANAT_ALSA
+class AudioInput
+{
+  private:
+    static const int fft_size = 1024;
+    static const int hop_size = fft_size / 2;
+
+    enum Kind
+    {
+        KIND_FILE,
+        KIND_FIFO,
+        KIND_ALSA,
+    };
+
+    const std::string source;
+    const float smoothing;
+    Kind kind = KIND_FILE;
+    int fd = -1;
+    int wake_fd = -1;
+    void *pcm = nullptr;
+    int rate = 44100;
+    int channels = 2;
+    // Where sample data starts and ends in a WAV file, for looping; chunks may follow it
+    off_t data_offset = 0;
+    off_t data_end = 0;
+    // Last read_fd() stopped at end of file, or a FIFO without a writer
+    bool at_eof = false;
+    std::atomic<bool> running;
+    pthread_t thread = 0;
+
+    // Analysis thread only
+    RealFFT fft;
+    std::vector<float> history;
+    std::vector<float> mags;
+    std::vector<float> smoothed;
+    // First FFT bin of each spectrum texel, and one past the last texel's; depends on the rate
+    std::vector<int> texel_bins;
+    int texel_bins_rate = 0;
+    std::vector<int16_t> pcm_buf;
+    uint64_t serial = 0;
+
+    // Triple buffer: one slot each for the writer and the reader, one in between. The
+    // in-between slot's index is in `latest`, with fresh_bit set if the reader hasn't seen it.
+    static const int fresh_bit = 4;
+    AudioFrame slots[3];
+    int write_ix = 0;
+    int read_ix = 1;
+    std::atomic<int> latest;
+
+  private:
+    static void *analysis_fun(void *arg);
+    void open_source();
+    bool read_wav_header();
+    bool wait_readable(int timeout_msec);
+    // Mono samples in [-1, 1]; false when there's nothing to read for now
+    bool read_samples(float *out, int count);
+    bool read_fd(void *buf, size_t len);
+    void map_texels();
+    void analyse();
+    void publish(const AudioFrame &frame);
+
+  public:
+    AudioInput(const std::string &source, float smoothing);
+    ~AudioInput();
+    // Render thread: the newest result if there's been one since the last call, or nullptr.
+    // Stays valid until the next call.
+    const AudioFrame *take_latest();
+};
+
+#endif
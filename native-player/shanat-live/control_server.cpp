@@ -0,0 +1,297 @@
+#include "control_server.h"
+#include "../shanat-shared/json.h"
+#include "../shanat-shared/trace.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static const char *unix_prefix = "unix:";
+static const char *tcp_prefix = "tcp:";
+
+ControlServer::ControlServer(const std::string &target, FrameStats *stats)
+    : target(target)
+    , stats(stats)
+{
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake_fd < 0)
+    {
+        fprintf(stderr, "Failed to create eventfd for control server\n");
+        exit(-1);
+    }
+    listen_on_target();
+    printf("Listening for control connections on %s\n", target.c_str());
+
+    if (pthread_create(&thread, nullptr, server_fun, this) != 0)
+    {
+        fprintf(stderr, "Failed to start control server thread\n");
+        exit(-1);
+    }
+}
+
+ControlServer::~ControlServer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) != sizeof(one)) fprintf(stderr, "Failed to wake control server thread\n");
+    pthread_join(thread, nullptr);
+
+    for (auto &client : clients) close(client.fd);
+    close(listen_fd);
+    close(wake_fd);
+    if (target.compare(0, strlen(unix_prefix), unix_prefix) == 0) unlink(target.substr(strlen(unix_prefix)).c_str());
+}
+
+void ControlServer::listen_on_target()
+{
+    bool ok = false;
+    if (target.compare(0, strlen(unix_prefix), unix_prefix) == 0)
+    {
+        std::string path = target.substr(strlen(unix_prefix));
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path))
+        {
+            fprintf(stderr, "Control socket path too long: '%s'\n", path.c_str());
+            exit(-1);
+        }
+        strcpy(addr.sun_path, path.c_str());
+        unlink(path.c_str());
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        ok = listen_fd >= 0 && bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) == 0;
+    }
+    else if (target.compare(0, strlen(tcp_prefix), tcp_prefix) == 0)
+    {
+        int port = atoi(target.c_str() + strlen(tcp_prefix));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        // Shaders from the network would be a remote GPU hang away; loopback only
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int yes = 1;
+        if (listen_fd >= 0) setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        ok = port > 0 && port < 65536 && listen_fd >= 0 && bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) == 0;
+    }
+    else
+    {
+        fprintf(stderr, "Control target must be unix:/path or tcp:PORT; got '%s'\n", target.c_str());
+        exit(-1);
+    }
+
+    if (!ok || listen(listen_fd, 4) != 0)
+    {
+        fprintf(stderr, "Failed to listen on control target '%s': %s\n", target.c_str(), strerror(errno));
+        exit(-1);
+    }
+}
+
+bool ControlServer::take_request(ControlRequest &req)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (requests.empty()) return false;
+    req = std::move(requests.front());
+    requests.pop_front();
+    return true;
+}
+
+void ControlServer::reply(uint64_t reply_to, const std::string &json)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        replies.push_back(std::make_pair(reply_to, json));
+    }
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) != sizeof(one)) fprintf(stderr, "Failed to wake control server thread\n");
+}
+
+void *ControlServer::server_fun(void *arg)
+{
+    ControlServer &cs = *(ControlServer *)arg;
+    trace_thread_name("control");
+
+    std::vector<pollfd> fds;
+    while (true)
+    {
+        fds.resize(2 + cs.clients.size());
+        fds[0].fd = cs.wake_fd;
+        fds[1].fd = cs.listen_fd;
+        fds[0].events = fds[1].events = POLLIN;
+        for (size_t i = 0; i < cs.clients.size(); ++i)
+        {
+            fds[2 + i].fd = cs.clients[i].fd;
+            fds[2 + i].events = POLLIN | (cs.clients[i].out.empty() ? 0 : POLLOUT);
+        }
+        for (auto &fd : fds) fd.revents = 0;
+
+        if (poll(&fds[0], fds.size(), -1) < 0 && errno != EINTR) break;
+
+        if (fds[0].revents)
+        {
+            uint64_t count;
+            if (read(cs.wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) break;
+            {
+                std::lock_guard<std::mutex> lock(cs.mutex);
+                if (!cs.running) break;
+            }
+            cs.deliver_replies();
+        }
+
+        // Backwards, so dropping a client doesn't shift the ones still to check
+        for (size_t i = fds.size() - 2; i-- > 0;)
+        {
+            Client &client = cs.clients[i];
+            short revents = fds[2 + i].revents;
+            bool ok = true;
+            if (revents & (POLLIN | POLLHUP | POLLERR)) ok = cs.read_client(client);
+            if (ok && (revents & POLLOUT)) ok = cs.write_client(client);
+            if (ok) continue;
+            close(client.fd);
+            cs.clients.erase(cs.clients.begin() + i);
+        }
+
+        if (fds[1].revents) cs.accept_client();
+    }
+    return nullptr;
+}
+
+void ControlServer::accept_client()
+{
+    int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (fd < 0) return;
+    if (clients.size() >= max_clients)
+    {
+        close(fd);
+        return;
+    }
+    Client client;
+    client.fd = fd;
+    client.id = next_client_id++;
+    client.seq = 0;
+    clients.push_back(client);
+}
+
+// False once the client is gone or broke the framing
+bool ControlServer::read_client(Client &client)
+{
+    char buf[65536];
+    while (true)
+    {
+        ssize_t n = recv(client.fd, buf, sizeof(buf), 0);
+        if (n > 0)
+        {
+            client.in.append(buf, n);
+            continue;
+        }
+        if (n == 0) return false;
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        return false;
+    }
+
+    size_t pos = 0;
+    while (client.in.size() - pos >= 4)
+    {
+        const unsigned char *p = (const unsigned char *)client.in.data() + pos;
+        uint32_t len = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+        if (len > max_frame_bytes) return false;
+        if (client.in.size() - pos - 4 < len) break;
+        handle_frame(client, client.in.substr(pos + 4, len));
+        pos += 4 + len;
+    }
+    client.in.erase(0, pos);
+    return true;
+}
+
+bool ControlServer::write_client(Client &client)
+{
+    while (!client.out.empty())
+    {
+        ssize_t n = send(client.fd, client.out.data(), client.out.size(), MSG_NOSIGNAL);
+        if (n > 0)
+        {
+            client.out.erase(0, n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+    return true;
+}
+
+void ControlServer::handle_frame(Client &client, const std::string &payload)
+{
+    TRACE_SCOPE("control_request");
+    uint32_t seq = ++client.seq;
+
+    ControlRequest req;
+    size_t eol = payload.find('\n');
+    std::string head = payload.substr(0, eol);
+    if (eol != std::string::npos) req.body = payload.substr(eol + 1);
+    for (size_t pos = 0; pos < head.size();)
+    {
+        size_t begin = head.find_first_not_of(" \t\r", pos);
+        if (begin == std::string::npos) break;
+        size_t end = head.find_first_of(" \t\r", begin);
+        if (end == std::string::npos) end = head.size();
+        if (req.command.empty()) req.command = head.substr(begin, end - begin);
+        else req.args.push_back(head.substr(begin, end - begin));
+        pos = end;
+    }
+
+    if (req.command == "stats")
+    {
+        std::string snapshot = stats ? stats->latest_json() : "";
+        while (!snapshot.empty() && snapshot.back() == '\n') snapshot.pop_back();
+        send_reply(client, seq, "{\"ok\":true,\"stats\":" + (snapshot.empty() ? "null" : snapshot) + "}");
+        return;
+    }
+    if (req.command != "apply" && req.command != "uniform")
+    {
+        send_reply(client, seq, "{\"ok\":false,\"error\":" + json_string("Unknown command '" + req.command + "'") + "}");
+        return;
+    }
+
+    req.reply_to = client.id << 32 | seq;
+    std::lock_guard<std::mutex> lock(mutex);
+    requests.push_back(std::move(req));
+}
+
+void ControlServer::send_reply(Client &client, uint32_t seq, const std::string &json)
+{
+    char head[32];
+    snprintf(head, sizeof(head), "{\"seq\":%u%s", seq, json.size() > 2 ? "," : "");
+    std::string payload = head + json.substr(1);
+    uint32_t len = payload.size();
+    const char frame_len[4] = {(char)(len >> 24), (char)(len >> 16), (char)(len >> 8), (char)len};
+    client.out.append(frame_len, 4);
+    client.out += payload;
+    // Whatever doesn't fit now goes when poll says the socket is writable
+    write_client(client);
+}
+
+void ControlServer::deliver_replies()
+{
+    std::deque<std::pair<uint64_t, std::string>> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ready.swap(replies);
+    }
+    for (auto &reply : ready)
+    {
+        uint64_t id = reply.first >> 32;
+        for (auto &client : clients)
+            if (client.id == id) send_reply(client, (uint32_t)reply.first, reply.second);
+    }
+}
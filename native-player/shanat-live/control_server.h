@@ -0,0 +1,82 @@
+#ifndef CONTROL_SERVER_H
+#define CONTROL_SERVER_H
+
+#include "../shanat-shared/frame_stats.h"
+
+#include <deque>
+#include <mutex>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct ControlRequest
+{
+    // Pass to ControlServer::reply()
+    uint64_t reply_to = 0;
+    std::string command;
+    std::vector<std::string> args;
+    std::string body;
+};
+
+// Lets a local client (the web editor's server) drive shanat-live without the filesystem.
+// Listens on "unix:/path" or "tcp:PORT" (127.0.0.1 only). Frames both ways are a 4-byte
+// big-endian length and a payload. A request's first line is the command and its arguments,
+// separated by spaces; the rest is the body:
+//
+//     apply [pass]          body is fragment shader source for a pass (default: the output)
+//     uniform NAME X [Y..]  sets a float uniform, vector or array in every pass that has it
+//     stats                 latest frame stats
+//
+// Every request gets exactly one JSON reply, {"seq":N,"ok":...}, where N counts the requests
+// on the connection from 1. Replies to apply come once the program has built, so they can
+// arrive after replies to later requests. "stats" is answered on the server's own thread;
+// everything else goes through take_request() on the render thread.
+class ControlServer
+{
+  private:
+    struct Client
+    {
+        int fd;
+        uint64_t id;
+        uint32_t seq;
+        std::string in;
+        std::string out;
+    };
+
+    static const size_t max_clients = 8;
+    static const uint32_t max_frame_bytes = 1024 * 1024;
+
+    const std::string target;
+    FrameStats *const stats;
+    int listen_fd = -1;
+    int wake_fd = -1;
+    bool running = true;
+    pthread_t thread = 0;
+    std::mutex mutex;
+    std::deque<ControlRequest> requests;
+    std::deque<std::pair<uint64_t, std::string>> replies;
+    // Server thread only
+    std::vector<Client> clients;
+    uint64_t next_client_id = 1;
+
+  private:
+    static void *server_fun(void *arg);
+    void listen_on_target();
+    void accept_client();
+    bool read_client(Client &client);
+    bool write_client(Client &client);
+    void handle_frame(Client &client, const std::string &payload);
+    void send_reply(Client &client, uint32_t seq, const std::string &json);
+    void deliver_replies();
+
+  public:
+    ControlServer(const std::string &target, FrameStats *stats);
+    ~ControlServer();
+    // Non-blocking; false if nothing is waiting
+    bool take_request(ControlRequest &req);
+    // JSON object, without "seq"; dropped if the client has gone
+    void reply(uint64_t reply_to, const std::string &json);
+};
+
+#endif
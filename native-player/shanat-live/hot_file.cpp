@@ -1,13 +1,80 @@
 #include "hot_file.h"
+#include "../shanat-shared/fps.h"
+#include "../shanat-shared/hash.h"
+#include "../shanat-shared/trace.h"
 
-#include <sys/stat.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <time.h>
 #include <unistd.h>
 
+// A burst of events must be quiet this long before we read the file...
+static const int debounce_msec = 20;
+// ...unless it keeps going for this long
+static const int64_t max_debounce_usec = 200000;
+// Interval of the fallback without inotify
+static const int poll_msec = 100;
+// Reads of a file that's still being written, and the pause between them
+static const int read_attempts = 5;
+static const int read_retry_usec = 10000;
+
+enum ReadStatus
+{
+    READ_OK,
+    READ_MISSING,
+    // Changed while we read it
+    READ_UNSTABLE,
+};
+
+// One fstat and one read for the whole file. Not mmap: a writer truncating the file under
+// a mapping turns into SIGBUS, and the content ends up in a string either way.
+static ReadStatus read_file(const char *fname, std::string &content, struct stat &st)
+{
+    int fd = open(fname, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return READ_MISSING;
+    ReadStatus status = READ_UNSTABLE;
+    if (fstat(fd, &st) == 0)
+    {
+        // Ask for one byte more than expected to notice a file that grew
+        size_t size = st.st_size;
+        content.resize(size + 1);
+        size_t got = 0;
+        while (got <= size)
+        {
+            ssize_t n = read(fd, &content[got], size + 1 - got);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) break;
+            got += n;
+        }
+        content.resize(got < size ? got : size);
+        struct stat after;
+        if (got == size && fstat(fd, &after) == 0 && after.st_size == st.st_size &&
+            after.st_mtim.tv_sec == st.st_mtim.tv_sec && after.st_mtim.tv_nsec == st.st_mtim.tv_nsec)
+            status = READ_OK;
+    }
+    close(fd);
+    return status;
+}
+
 HotFile::HotFile(const std::string &fname)
     : fname(fname)
+    , running(true)
 {
-    modif = get_modif();
-    read_content(content);
+    wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wake_fd < 0)
+    {
+        fprintf(stderr, "Failed to create eventfd for '%s'\n", fname.c_str());
+        exit(-1);
+    }
+    // Watch first, so a change while we read the file isn't lost
+    if (!start_inotify()) printf("No inotify for '%s'; polling for changes\n", fname.c_str());
+
+    reload();
 
     if (pthread_create(&thread, nullptr, watcher_fun, this) != 0)
     {
@@ -19,72 +86,170 @@ HotFile::HotFile(const std::string &fname)
 HotFile::~HotFile()
 {
     running = false;
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) != sizeof(one)) fprintf(stderr, "Failed to wake hotfile thread\n");
     struct timespec timeout;
     clock_gettime(CLOCK_REALTIME, &timeout);
     timeout.tv_nsec += 100000000; // 100 msec
+    if (timeout.tv_nsec >= 1000000000)
+    {
+        timeout.tv_nsec -= 1000000000;
+        ++timeout.tv_sec;
+    }
     int ret = pthread_timedjoin_np(thread, nullptr, &timeout);
     if (ret == ETIMEDOUT)
     {
         fprintf(stderr, "Hotfile thread failed to exit\n");
         exit(-1);
     }
+    if (inotify_fd >= 0) close(inotify_fd);
+    close(wake_fd);
+}
+
+bool HotFile::start_inotify()
+{
+    size_t slash = fname.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : fname.substr(0, slash);
+    base_name = slash == std::string::npos ? fname : fname.substr(slash + 1);
+
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0) return false;
+    // The directory, not the file: editors and the web editor replace the file by renaming a new one over it
+    const uint32_t mask = IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+    if (inotify_add_watch(inotify_fd, dir.c_str(), mask) >= 0) return true;
+    close(inotify_fd);
+    inotify_fd = -1;
+    return false;
 }
 
 void *HotFile::watcher_fun(void *arg)
 {
     HotFile &hf = *(HotFile *)arg;
+    trace_thread_name("hotfile");
 
-    std::string content;
-    int64_t last_modif;
+    if (hf.inotify_fd >= 0) hf.watch_inotify();
+    if (!hf.running) return nullptr;
+    if (hf.lost_watch) printf("Lost inotify watch for '%s'; polling for changes\n", hf.fname.c_str());
+    hf.watch_polling();
+    return nullptr;
+}
+
+// True if any event was about our file; sets lost_watch if the directory went away
+bool HotFile::drain_events()
+{
+    alignas(inotify_event) char buf[4096];
+    bool relevant = false;
+    while (true)
     {
-        std::lock_guard<std::mutex> lock(hf.mutex);
-        last_modif = hf.modif;
+        ssize_t len = read(inotify_fd, buf, sizeof(buf));
+        if (len <= 0) break;
+        for (char *p = buf; p < buf + len;)
+        {
+            const inotify_event *ev = (const inotify_event *)p;
+            p += sizeof(inotify_event) + ev->len;
+            // Dropped events could have been ours
+            if (ev->mask & IN_Q_OVERFLOW) relevant = true;
+            if (ev->mask & IN_IGNORED)
+            {
+                relevant = true;
+                lost_watch = true;
+            }
+            else if (ev->len > 0 && base_name == ev->name) relevant = true;
+        }
     }
+    return relevant;
+}
 
-    while (hf.running)
+void HotFile::watch_inotify()
+{
+    pollfd fds[2] = {};
+    fds[0].fd = wake_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = inotify_fd;
+    fds[1].events = POLLIN;
+
+    // Start of the burst we're waiting out, or 0
+    int64_t burst_start = 0;
+    while (running && !lost_watch)
     {
-        int64_t modif = hf.get_modif();
-        if (modif != last_modif)
+        int n = poll(fds, 2, burst_start ? debounce_msec : -1);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 || fds[0].revents) break;
+        if (n > 0 && drain_events() && !burst_start) burst_start = monotonic_usec();
+        if (!burst_start) continue;
+        if (n == 0 || lost_watch || monotonic_usec() - burst_start >= max_debounce_usec)
         {
-            hf.read_content(content);
-            last_modif = modif;
-            std::lock_guard<std::mutex> lock(hf.mutex);
-            hf.content.assign(content);
-            hf.modif = modif;
+            reload();
+            burst_start = 0;
         }
-        // 100 msec
-        usleep(100000);
     }
-    return nullptr;
 }
 
-void HotFile::read_content(std::string &content)
+void HotFile::watch_polling()
 {
-    content.clear();
-    FILE *file = fopen(fname.c_str(), "rb");
-    if (!file) return;
-
-    fseek(file, 0, SEEK_END);
-    const size_t size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+    pollfd fd = {};
+    fd.fd = wake_fd;
+    fd.events = POLLIN;
+    while (running)
+    {
+        int n = poll(&fd, 1, poll_msec);
+        if (n < 0 && errno == EINTR) continue;
+        if (n != 0) break;
+        bool changed;
+        {
+            TRACE_SCOPE("hotfile_poll");
+            changed = stat_changed();
+        }
+        if (changed) reload();
+    }
+}
 
-    content.resize(size + 1, '\0');
-    fread(&content[0], 1, size, file);
-    fclose(file);
+// Full timestamp, size and inode: a same-millisecond rewrite or a rename onto the file still shows
+bool HotFile::stat_changed()
+{
+    struct stat st;
+    bool exists = stat(fname.c_str(), &st) == 0;
+    if (exists != last_exists) return true;
+    if (!exists) return false;
+    return st.st_mtim.tv_sec != last_stat.st_mtim.tv_sec || st.st_mtim.tv_nsec != last_stat.st_mtim.tv_nsec ||
+           st.st_size != last_stat.st_size || st.st_ino != last_stat.st_ino;
 }
 
-int64_t HotFile::get_modif() const
+void HotFile::reload()
 {
-    struct stat file_stat;
-    if (stat(fname.c_str(), &file_stat) != 0)
-        return 0;
+    TRACE_SCOPE("hotfile_read");
+    std::string fresh;
+    struct stat st;
+    ReadStatus status = READ_UNSTABLE;
+    for (int attempt = 0; attempt < read_attempts && status == READ_UNSTABLE; ++attempt)
+    {
+        if (attempt > 0) usleep(read_retry_usec);
+        status = read_file(fname.c_str(), fresh, st);
+        // Empty is usually a file truncated for rewriting; believe it only if it stays that way
+        if (status == READ_OK && fresh.empty() && attempt + 1 < read_attempts) status = READ_UNSTABLE;
+    }
+    // Next event, or the next poll, tries again
+    if (status == READ_UNSTABLE)
+    {
+        fprintf(stderr, "File kept changing while reading: %s\n", fname.c_str());
+        return;
+    }
 
-    int64_t msec = file_stat.st_mtim.tv_nsec / 1000000;
-    return file_stat.st_mtim.tv_sec * 1000 + msec;
+    last_exists = status == READ_OK;
+    if (last_exists) last_stat = st;
+    uint64_t hash = last_exists ? xxhash64(fresh.data(), fresh.size()) : 0;
+    // Same bytes as before, e.g. touched or saved without edits: nothing to rebuild
+    if (last_exists == (modif != 0) && hash == content_hash) return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    content.swap(fresh);
+    content_hash = hash;
+    modif = last_exists ? ++version : 0;
 }
 
 bool HotFile::check_update(std::string &content, int64_t &modif)
 {
+    TRACE_SCOPE("hotfile_check");
     std::lock_guard<std::mutex> lock(mutex);
     if (modif == this->modif) return false;
     modif = this->modif;
@@ -1,29 +1,53 @@
 #ifndef HOT_FILE_H
 #define HOT_FILE_H
 
+#include <atomic>
 #include <mutex>
 #include <pthread.h>
 #include <stdint.h>
 #include <string>
+#include <sys/stat.h>
 
+// Keeps the latest content of a file that's edited while we run.
+// A watcher thread listens for inotify events on the containing directory, which also catches
+// editors that write a temp file and rename it into place. A burst of events is read once,
+// after it's been quiet for a moment. Without inotify, it falls back to polling stat().
+// Only a change in content counts: saving the same bytes again is not an update. A file that
+// changes while we read it is read again rather than handed out half-written.
 class HotFile
 {
   private:
     const std::string fname;
-    bool running = true;
+    std::atomic<bool> running;
     pthread_t thread = 0;
+    // Wakes the watcher for shutdown
+    int wake_fd = -1;
+    int inotify_fd = -1;
+    bool lost_watch = false;
+    std::string base_name;
     std::mutex mutex;
-    int64_t modif;
+    // Bumped on every change of content; 0 while the file is missing
+    int64_t modif = 0;
+    int64_t version = 1;
     std::string content;
+    uint64_t content_hash = 0;
+    // What the polling fallback compares to spot a change
+    struct stat last_stat;
+    bool last_exists = false;
 
   private:
     static void *watcher_fun(void *arg);
-    int64_t get_modif() const;
-    void read_content(std::string &content);
+    bool start_inotify();
+    void watch_inotify();
+    void watch_polling();
+    bool drain_events();
+    bool stat_changed();
+    void reload();
 
   public:
     HotFile(const std::string &fname);
     ~HotFile();
+    // Content and change counter, if they moved on from the modif passed in
     bool check_update(std::string &content, int64_t &modif);
 };
 
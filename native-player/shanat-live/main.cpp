@@ -1,9 +1,24 @@
+#include "../shanat-shared/adaptive_res.h"
+#include "../shanat-shared/arg_parse.h"
 #include "../shanat-shared/fps.h"
+#include "../shanat-shared/frame_stats.h"
 #include "../shanat-shared/geo.h"
+#include "../shanat-shared/gpu_fences.h"
 #include "../shanat-shared/horrors.h"
-#include "arg_parse.h"
-#include "hot_file.h"
-
+#include "../shanat-shared/horrors_args.h"
+#include "../shanat-shared/json.h"
+#include "../shanat-shared/offline.h"
+#include "../shanat-shared/profiler.h"
+#include "../shanat-shared/program_cache.h"
+#include "../shanat-shared/render_state.h"
+#include "../shanat-shared/shanat_uniforms.h"
+#include "../shanat-shared/trace.h"
+#include "audio_input.h"
+#include "control_server.h"
+#include "playlist.h"
+#include "shader_worker.h"
+
+#include <cinttypes>
 #include <csignal>
 #include <cstdio>
 #include <cstdlib>
@@ -13,34 +28,61 @@
 #include <string.h>
 #include <string>
 #include <unistd.h>
-
-static const char *defaultDevicePath = "/dev/dri/card0";
-
-static const char *devicePath = defaultDevicePath;
+#include <vector>
+
+static HorrorsOptions horrors_opts;
+static OfflineOptions offline_opts;
+static std::string stats_target;
+static std::string control_target;
+static std::string resp_file;
+static std::string uniforms_shm;
+static std::string audio_source;
+static float audio_smooth = 0.4f;
+static std::string trace_file;
+static std::string cache_dir = ProgramCache::default_dir();
 static int target_fps;
-static std::string frag_glsl_file;
-static int64_t frag_glsl_modif;
-static std::string frag_glsl_content;
-
-GLuint vs = 0;
-GLuint fs = 0;
-GLuint prog = 0;
+static LatePolicy late_policy = LATE_SKIP;
+static float adaptive_min = 0;
+static float adaptive_max = 1;
+static std::vector<std::string> frag_glsl_files;
+static float crossfade_secs = 0;
+static float switch_every_secs = 0;
 
 static bool running = true;
+// Playlist entries to move by, from SIGUSR1 (next) and SIGUSR2 (previous)
+static volatile sig_atomic_t skip_request = 0;
 
 static void sighandler(int)
 {
     running = false;
 }
 
+static void skip_sighandler(int sig)
+{
+    skip_request += sig == SIGUSR1 ? 1 : -1;
+}
+
 static void parse_args(int argc, const char *argv[])
 {
     auto parser = ArgumentParser("shanat-live");
     parser.add_argument("help", "--help", "", "Displays this help message");
-    parser.add_argument("dev", "--dev", "", "Device path (default: /dev/dri/card0)", STORE);
+    add_horrors_arguments(parser);
+    add_offline_arguments(parser);
     parser.add_argument("fps", "--fps", "", "Target FPS (default: 25)", STORE, "25");
-    parser.add_argument("frag", "--frag", "", "Fragment shader GLSL file (input)", STORE);
+    parser.add_argument("late", "--late", "", "Missed frame deadlines: skip or catchup (default: skip)", STORE, "skip");
+    parser.add_argument("adaptive", "--adaptive", "", "Adapt render scale to frame time within MIN:MAX, e.g. 0.25:1", STORE);
+    parser.add_argument("stats", "--stats", "", "Publish frame stats as JSON to a file or unix:/socket/path", STORE);
+    parser.add_argument("trace", "--trace", "", "Record a timeline in Chrome trace-event JSON to this file", STORE);
+    parser.add_argument("cache", "--cache", "", "Program binary cache directory, or 'off' (default: ~/.cache/shanat)", STORE);
+    parser.add_argument("frag", "--frag", "", "Fragment shader GLSL file (input); passes in a .passes file next to it", STORE);
+    parser.add_argument("playlist", "--playlist", "", "File listing fragment shader files to switch between, instead of --frag", STORE);
+    parser.add_argument("switch_every", "--switch-every", "", "Move to the next playlist entry every this many seconds", STORE);
+    parser.add_argument("crossfade", "--crossfade", "", "Crossfade between playlist entries over this many seconds", STORE);
     parser.add_argument("resp", "--resp", "", "Update response file (output)", STORE);
+    parser.add_argument("uniforms", "--uniforms", "", "Take uniform values from this shared memory channel, e.g. " SHANAT_UNIFORMS_DEFAULT_NAME, STORE);
+    parser.add_argument("audio", "--audio", "", "Audio to analyse: WAV file, FIFO (WAV or raw 16-bit stereo 44.1 kHz), or alsa:DEVICE", STORE);
+    parser.add_argument("audio_smooth", "--audio-smooth", "", "Spectrum smoothing from one analysis to the next, 0 to 1 (default: 0.4)", STORE, "0.4");
+    parser.add_argument("control", "--control", "", "Accept shaders and uniforms on unix:/socket/path or tcp:PORT (localhost)", STORE);
 
     bool success = parser.parse(argv, argc, stdout);
     if (!success || parser.get("help").is_set)
@@ -49,16 +91,8 @@ static void parse_args(int argc, const char *argv[])
         exit(success ? 0 : 1);
     }
 
-    bool ok = true;
-
-    if (parser.get("dev").is_set)
-    {
-        auto dev_val = parser.get("dev").value.c_str();
-        size_t len = strlen(dev_val);
-        char *cpy = (char *)malloc(len + 1);
-        strncpy(cpy, dev_val, len);
-        devicePath = cpy;
-    }
+    bool ok = read_horrors_arguments(parser, horrors_opts);
+    ok &= read_offline_arguments(parser, offline_opts);
 
     auto fps_val = parser.get("fps").value;
     target_fps = atoi(fps_val.c_str());
@@ -68,11 +102,71 @@ static void parse_args(int argc, const char *argv[])
         ok = false;
     }
 
-    auto frag_val = parser.get("frag");
-    if (frag_val.is_set) frag_glsl_file.assign(frag_val.value);
+    auto late_val = parser.get("late").value;
+    if (late_val == "skip") late_policy = LATE_SKIP;
+    else if (late_val == "catchup") late_policy = LATE_CATCH_UP;
     else
     {
-        fprintf(stderr, "Fragment shader GLSL file is required\n");
+        fprintf(stderr, "Late policy must be 'skip' or 'catchup'; got '%s'\n", late_val.c_str());
+        ok = false;
+    }
+
+    auto adaptive_val = parser.get("adaptive");
+    if (adaptive_val.is_set)
+    {
+        int n = sscanf(adaptive_val.value.c_str(), "%f:%f", &adaptive_min, &adaptive_max);
+        if (n < 1 || adaptive_min <= 0 || adaptive_max > 1 || adaptive_min > adaptive_max)
+        {
+            fprintf(stderr, "Adaptive bounds must be MIN:MAX within (0, 1]; got '%s'\n", adaptive_val.value.c_str());
+            ok = false;
+        }
+    }
+
+    if (adaptive_val.is_set && offline_opts.frames > 0)
+    {
+        fprintf(stderr, "--adaptive and --offline don't mix\n");
+        ok = false;
+    }
+
+    if (parser.get("stats").is_set) stats_target = parser.get("stats").value;
+    if (parser.get("trace").is_set) trace_file = parser.get("trace").value;
+    if (parser.get("control").is_set) control_target = parser.get("control").value;
+    if (parser.get("resp").is_set) resp_file = parser.get("resp").value;
+    if (parser.get("uniforms").is_set) uniforms_shm = parser.get("uniforms").value;
+    if (parser.get("audio").is_set) audio_source = parser.get("audio").value;
+    audio_smooth = atof(parser.get("audio_smooth").value.c_str());
+    if (audio_smooth < 0 || audio_smooth >= 1)
+    {
+        fprintf(stderr, "Audio smoothing must be at least 0 and less than 1\n");
+        ok = false;
+    }
+    if (!audio_source.empty() && offline_opts.frames > 0)
+    {
+        fprintf(stderr, "--audio and --offline don't mix\n");
+        ok = false;
+    }
+    if (parser.get("cache").is_set) cache_dir = parser.get("cache").value;
+    if (cache_dir == "off") cache_dir.clear();
+
+    auto frag_val = parser.get("frag");
+    auto playlist_val = parser.get("playlist");
+    if (frag_val.is_set) frag_glsl_files.push_back(frag_val.value);
+    if (playlist_val.is_set && !Playlist::read(playlist_val.value, frag_glsl_files))
+    {
+        fprintf(stderr, "Cannot read playlist '%s'\n", playlist_val.value.c_str());
+        ok = false;
+    }
+    else if (frag_glsl_files.empty())
+    {
+        fprintf(stderr, "Fragment shader GLSL file or non-empty playlist is required\n");
+        ok = false;
+    }
+
+    if (parser.get("switch_every").is_set) switch_every_secs = atof(parser.get("switch_every").value.c_str());
+    if (parser.get("crossfade").is_set) crossfade_secs = atof(parser.get("crossfade").value.c_str());
+    if (switch_every_secs < 0 || crossfade_secs < 0 || (switch_every_secs > 0 && crossfade_secs >= switch_every_secs))
+    {
+        fprintf(stderr, "Switch and crossfade times must be positive, crossfade shorter than switch time\n");
         ok = false;
     }
 
@@ -83,10 +177,99 @@ static void parse_args(int argc, const char *argv[])
     }
 }
 
-static void main_inner();
-static void report_shader_link_error(GLuint prog);
-static GLuint compile_shader(GLenum type, const char *src, bool exit_on_error);
-static void update_program();
+static int main_inner();
+
+static std::string report_json(const BuildReport &report)
+{
+    char usec[32];
+    snprintf(usec, sizeof(usec), "%" PRId64, report.build_usec);
+    return std::string("{\"ok\":") + (report.ok ? "true" : "false") + ",\"file\":" + json_string(report.file) +
+           ",\"pass\":" + json_string(report.pass) + ",\"build_usec\":" + usec + ",\"log\":" + json_string(report.log) +
+           ",\"superseded\":" + (report.superseded ? "true" : "false") + "}";
+}
+
+// Written next to it and renamed, so a reader never sees half a response
+static void write_resp_file(const std::string &json)
+{
+    std::string tmp = resp_file + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "w");
+    if (!f)
+    {
+        fprintf(stderr, "Cannot write response file '%s'\n", tmp.c_str());
+        return;
+    }
+    bool ok = fprintf(f, "%s\n", json.c_str()) > 0;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), resp_file.c_str()) != 0) fprintf(stderr, "Cannot write response file '%s'\n", resp_file.c_str());
+}
+
+static std::string error_json(const std::string &error)
+{
+    return "{\"ok\":false,\"error\":" + json_string(error) + "}";
+}
+
+// Hands values from the shared memory channel to the playlist if a writer changed them
+static void read_shm_uniforms(const ShanatUniforms *shm, ShanatUniformData &data, uint32_t &seq, Playlist &playlist)
+{
+    if (shanat_uniforms_seq(shm) == seq || !shanat_uniforms_read(shm, &data, &seq)) return;
+    for (uint32_t i = 0; i < data.count; ++i)
+    {
+        ShanatUniformSlot &slot = data.slots[i];
+        slot.name[SHANAT_UNIFORM_NAME_LEN - 1] = 0;
+        playlist.set_uniform(slot.name, slot.vals, slot.n);
+    }
+}
+
+// Newest analysis, if any, into the spectrum texture and the fft uniform
+static void update_audio(AudioInput &audio, GLuint spectrum_tex, Playlist &playlist)
+{
+    const AudioFrame *frame = audio.take_latest();
+    if (!frame) return;
+    render_state.bind_texture(spectrum_tex);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, AudioFrame::spectrum_size, 1, GL_LUMINANCE, GL_UNSIGNED_BYTE, frame->spectrum);
+    playlist.set_uniform("fft", frame->bands, 4);
+}
+
+static void handle_control_request(ControlServer &control, Playlist &playlist, const ControlRequest &req)
+{
+    std::string error;
+    if (req.command == "apply")
+    {
+        std::string pass_name = req.args.empty() ? "" : req.args[0];
+        // The reply goes out once the program has built
+        if (!playlist.apply(pass_name, req.body, req.reply_to, error)) control.reply(req.reply_to, error_json(error));
+        return;
+    }
+
+    // uniform NAME X [Y..]
+    GLfloat vals[16];
+    int n = 0;
+    bool ok = req.args.size() >= 2 && req.args.size() <= 17;
+    for (size_t i = 1; ok && i < req.args.size(); ++i)
+    {
+        char *end;
+        vals[n++] = strtof(req.args[i].c_str(), &end);
+        ok = *end == 0 && end != req.args[i].c_str();
+    }
+    if (ok && playlist.set_uniform(req.args[0], vals, n)) control.reply(req.reply_to, "{\"ok\":true}");
+    else control.reply(req.reply_to, error_json("Expected: uniform NAME X [Y..], up to 16 numbers"));
+}
+
+static const char *vert_sweep_glsl = R"(
+#version 310 es
+in vec2 a_pos;
+void main() {
+    gl_Position = vec4(a_pos, 0.0, 1.0);
+}
+)";
+
+// For fragment shaders in GLSL ES 1.00, e.g., Hydra's output
+static const char *vert_sweep_glsl_100 = R"(
+attribute vec2 a_pos;
+void main() {
+    gl_Position = vec4(a_pos, 0.0, 1.0);
+}
+)";
 
 int main(int argc, const char *argv[])
 {
@@ -94,154 +277,190 @@ int main(int argc, const char *argv[])
 
     signal(SIGINT, sighandler);
     signal(SIGTERM, sighandler);
+    signal(SIGUSR1, skip_sighandler);
+    signal(SIGUSR2, skip_sighandler);
 
-    main_inner();
+    if (!trace_file.empty()) trace_start(trace_file.c_str());
+    trace_thread_name("render");
+
+    int status = main_inner();
 
     printf("\nGoodbye!\n");
-    return 0;
+    trace_stop();
+    return status;
 }
 
-static void main_inner()
+static int main_inner()
 {
     // Set up graphics
-    init_horrors(devicePath);
+    init_horrors(horrors_opts);
 
     // FPS control
-    FPS fps(target_fps);
-
-    // Fragment shader source
-    HotFile hf(frag_glsl_file.c_str());
-    hf.check_update(frag_glsl_content, frag_glsl_modif);
-    printf("Watching shader file: %s\n", frag_glsl_file.c_str());
-    if (frag_glsl_modif == 0) printf("File appears to be missing\n");
+    FPS fps(target_fps, late_policy);
+    fps.set_vblank_source(get_vblank_timing);
+    FrameStats stats(stats_target);
+    fps.set_stats(&stats);
 
-    // Compile shaders, link program
-    update_program();
+    // Compile shaders, link programs off the render thread
+    ProgramCache program_cache(cache_dir);
+    std::unique_ptr<ShaderWorker> shader_worker(new ShaderWorker(vert_sweep_glsl, vert_sweep_glsl_100, &program_cache));
 
     // OpenGL fidgeting
-    glEnable(GL_BLEND);
+    render_state.set_enabled(GL_BLEND, true);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glEnable(GL_DEPTH_TEST);
+    render_state.set_enabled(GL_DEPTH_TEST, true);
     glDepthFunc(GL_LESS);
+    glClearColor(0, 0, 0, 1);
 
-    // Buffer the shader will be outputting to
-    GLuint vbo;
-    glGenBuffers(1, &vbo);
-
-    // Vertex shader's two fixed triangles
-    GLfloat sweep_verts[] = {
+    // Vertex shader's two fixed triangles, uploaded once
+    static const GLfloat sweep_verts[] = {
         -1, -1,
         1, -1,
         -1, 1,
         -1, 1,
         1, -1,
         1, 1};
+    GLuint vbo;
+    glGenBuffers(1, &vbo);
+    render_state.bind_array_buffer(vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(sweep_verts), sweep_verts, GL_STATIC_DRAW);
+
+    // Frame completion tracking without stalling on glFinish
+    GpuFences fences;
+
+    // Offscreen target that follows frame time, if asked for
+    std::unique_ptr<AdaptiveRes> adaptive;
+    if (adaptive_min > 0) adaptive.reset(new AdaptiveRes(adaptive_min, adaptive_max, surface_width, surface_height));
+
+    // Sketches, each a graph of passes with watched fragment shader files
+    ShaderSources shader_sources;
+    std::unique_ptr<Playlist> playlist(new Playlist(frag_glsl_files, shader_sources, *shader_worker, vbo, crossfade_secs, switch_every_secs));
+
+    // Shaders and uniforms pushed by the editor, and what to tell it about builds
+    std::unique_ptr<ControlServer> control;
+    if (!control_target.empty()) control.reset(new ControlServer(control_target, &stats));
+    std::vector<BuildReport> reports;
+
+    // Values from MIDI bridges, sequencers and the like; read once per frame without locking
+    ShanatUniforms *shm = nullptr;
+    std::unique_ptr<ShanatUniformData> shm_data(new ShanatUniformData());
+    // Odd: never matches, so values left from an earlier run apply right away
+    uint32_t shm_seq = 1;
+    if (!uniforms_shm.empty())
+    {
+        shm = shanat_uniforms_open(uniforms_shm.c_str(), 1);
+        if (!shm)
+        {
+            fprintf(stderr, "Cannot open uniform channel '%s': %s\n", uniforms_shm.c_str(), strerror(errno));
+            exit(-1);
+        }
+        printf("Taking uniforms from shared memory %s\n", uniforms_shm.c_str());
+    }
 
-    // Get uniform locations
-    GLint time_loc = glGetUniformLocation(prog, "time");
-    GLint resolution_loc = glGetUniformLocation(prog, "resolution");
+    // Spectrum as `uniform sampler2D spectrum;` and four bands as `uniform float fft[4];`
+    std::unique_ptr<AudioInput> audio;
+    GLuint spectrum_tex = 0;
+    if (!audio_source.empty())
+    {
+        audio.reset(new AudioInput(audio_source, audio_smooth));
+        glGenTextures(1, &spectrum_tex);
+        render_state.bind_texture(spectrum_tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        std::vector<uint8_t> silence(AudioFrame::spectrum_size, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, AudioFrame::spectrum_size, 1, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, &silence[0]);
+        playlist->set_texture("spectrum", spectrum_tex);
+        static const GLfloat no_bands[4] = {0, 0, 0, 0};
+        playlist->set_uniform("fft", no_bands, 4);
+    }
+    auto answer_reports = [&]() {
+        playlist->take_reports(reports);
+        for (auto &report : reports)
+        {
+            std::string json = report_json(report);
+            if (control && report.reply_to != 0) control->reply(report.reply_to, json);
+            if (!resp_file.empty()) write_resp_file(json);
+        }
+        reports.clear();
+    };
     // ===================================================
 
-    while (running)
+    // Fixed timestep, no pacing or presenting; programs must all be there for the first frame
+    if (offline_opts.frames > 0)
     {
-        if (hf.check_update(frag_glsl_content, frag_glsl_modif))
+        shader_worker->wait_idle();
+        OfflineRenderer offline(offline_opts, surface_width, surface_height);
+        float current_time;
+        while (running && !shader_worker->has_failed() && offline.next_frame(current_time))
         {
-            printf("File updated                                               \n");
-            update_program();
-            time_loc = glGetUniformLocation(prog, "time");
-            resolution_loc = glGetUniformLocation(prog, "resolution");
+            TRACE_SCOPE("frame");
+            playlist->update(current_time);
+            answer_reports();
+            {
+                ProfScope prof(PROF_DRAW);
+                playlist->render(offline.framebuffer(), surface_width, surface_height, current_time, 1.0f);
+            }
+            offline.frame_done();
         }
+        offline.finish();
+        running = false;
+    }
 
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    while (running)
+    {
+        TRACE_SCOPE("frame");
         float current_time = fps.frame_start();
+        int skip = skip_request;
+        if (skip != 0)
+        {
+            skip_request -= skip;
+            playlist->skip(skip);
+        }
+        ControlRequest req;
+        while (control && control->take_request(req)) handle_control_request(*control, *playlist, req);
+        if (shm) read_shm_uniforms(shm, *shm_data, shm_seq, *playlist);
+        if (audio) update_audio(*audio, spectrum_tex, *playlist);
+        playlist->update(current_time);
+        answer_reports();
+        // The worker can't build anything anymore; tear down from here, where nothing draws
+        if (shader_worker->has_failed()) break;
+
+        GLuint target_fbo = default_fbo;
+        uint32_t width = surface_width, height = surface_height;
+        if (adaptive)
+        {
+            adaptive->update(fps);
+            target_fbo = adaptive->framebuffer();
+            width = adaptive->width();
+            height = adaptive->height();
+        }
 
-        glUniform1f(time_loc, current_time);
-        glUniform2f(resolution_loc, (float)mode.hdisplay, (float)mode.vdisplay);
-
-        glBufferData(GL_ARRAY_BUFFER, sizeof(sweep_verts), sweep_verts, GL_STATIC_DRAW);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
-
-        glViewport(0, 0, mode.hdisplay, mode.vdisplay);
-        glClearColor(0, 0, 0, 1);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        glFinish();
+        {
+            ProfScope prof(PROF_DRAW);
+            playlist->render(target_fbo, width, height, current_time, adaptive ? adaptive->get_scale() : 1.0f);
+            if (adaptive) adaptive->present();
+        }
+        fences.frame_submitted();
+        fps.work_done(fences.get_last_gpu_usec());
 
+        fences.check();
         put_on_screen();
 
+        fences.wait_until(fps.get_next_slot());
         fps.frame_end();
     }
 
-    glDeleteBuffers(1, &vbo);
+    int status = shader_worker->has_failed() ? 1 : 0;
+    adaptive.reset();
+    control.reset();
+    audio.reset();
+    if (spectrum_tex != 0) render_state.delete_texture(spectrum_tex);
+    shanat_uniforms_close(shm);
+    playlist.reset();
+    shader_worker.reset();
+    render_state.delete_buffer(vbo);
     cleanup_horrors();
-}
-
-static GLuint compile_shader(GLenum type, const char *src, bool exit_on_error)
-{
-    GLuint s = glCreateShader(type);
-    glShaderSource(s, 1, &src, nullptr);
-    glCompileShader(s);
-    GLint ok = 0;
-    glGetShaderiv(s, GL_COMPILE_STATUS, &ok);
-    if (!ok)
-    {
-        GLint len = 0;
-        glGetShaderiv(s, GL_INFO_LOG_LENGTH, &len);
-        char *log = new char[len ? len : 1];
-        log[0] = '\0';
-        glGetShaderInfoLog(s, len, nullptr, log);
-        fprintf(stderr, "Shader compile error: %s\n", log);
-        delete[] log;
-        if (exit_on_error)
-            exit_with_cleanup(1);
-        // TODO: Report via file
-        glDeleteShader(s);
-        return 0;
-    }
-    return s;
-}
-
-static void report_shader_link_error(GLuint prog)
-{
-    GLint len = 0;
-    glGetProgramiv(prog, GL_INFO_LOG_LENGTH, &len);
-    char *log = new char[len ? len : 1];
-    log[0] = '\0';
-    glGetProgramInfoLog(prog, len, nullptr, log);
-    fprintf(stderr, "Program link error: %s\n", log);
-    delete[] log;
-    exit_with_cleanup(1);
-}
-
-static const char *vert_sweep_glsl = R"(
-#version 310 es
-in vec2 a_pos;
-void main() {
-    gl_Position = vec4(a_pos, 0.0, 1.0);
-}
-)";
-
-static void update_program()
-{
-    // Delete previous
-    if (vs != 0) glDeleteShader(vs);
-    if (fs != 0) glDeleteShader(fs);
-    if (prog == 0) glDeleteProgram(prog);
-    prog = vs = fs = 0;
-
-    // Compile shaders; fall back to placeholder fragment shader on error
-    vs = compile_shader(GL_VERTEX_SHADER, vert_sweep_glsl, true);
-    fs = compile_shader(GL_FRAGMENT_SHADER, frag_glsl_content.c_str(), false);
-
-    prog = glCreateProgram();
-    glAttachShader(prog, vs);
-    glAttachShader(prog, fs);
-    const GLint ixPosAttribute = 0;
-    glBindAttribLocation(prog, ixPosAttribute, "a_pos");
-    glLinkProgram(prog);
-    GLint ok = 0;
-    glGetProgramiv(prog, GL_LINK_STATUS, &ok);
-    if (!ok) report_shader_link_error(prog);
-    glUseProgram(prog);
+    return status;
 }
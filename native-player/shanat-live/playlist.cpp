@@ -0,0 +1,225 @@
+#include "playlist.h"
+#include "../shanat-shared/horrors.h"
+
+#include <cstdio>
+#include <cstring>
+
+static const char *mix_vert = R"(
+attribute vec2 a_pos;
+varying vec2 uv;
+void main() {
+    uv = a_pos * 0.5 + 0.5;
+    gl_Position = vec4(a_pos, 0.0, 1.0);
+}
+)";
+
+static const char *mix_frag = R"(
+precision mediump float;
+uniform sampler2D from;
+uniform sampler2D to;
+uniform float amount;
+varying vec2 uv;
+void main() {
+    gl_FragColor = vec4(mix(texture2D(from, uv).rgb, texture2D(to, uv).rgb, amount), 1.0);
+}
+)";
+
+static GLuint compile_mix_shader(GLenum type, const char *src)
+{
+    GLuint s = glCreateShader(type);
+    glShaderSource(s, 1, &src, nullptr);
+    glCompileShader(s);
+    GLint ok = 0;
+    glGetShaderiv(s, GL_COMPILE_STATUS, &ok);
+    if (!ok) die("glCompileShader (crossfade)");
+    return s;
+}
+
+bool Playlist::read(const std::string &path, std::vector<std::string> &frag_files)
+{
+    FILE *f = fopen(path.c_str(), "r");
+    if (!f) return false;
+
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+
+    char line[512];
+    while (fgets(line, sizeof(line), f))
+    {
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        char *tok = strtok(line, " \t\r\n");
+        if (!tok) continue;
+        frag_files.push_back(tok[0] == '/' ? tok : dir + tok);
+    }
+    fclose(f);
+    return true;
+}
+
+Playlist::Playlist(const std::vector<std::string> &frag_files, ShaderSources &sources, ShaderWorker &worker, GLuint quad_vbo,
+                   float crossfade_secs, float switch_every_secs)
+    : sources(sources)
+    , worker(worker)
+    , quad_vbo(quad_vbo)
+    , crossfade_secs(crossfade_secs)
+    , switch_every_secs(switch_every_secs)
+{
+    for (size_t i = 0; i < frag_files.size(); ++i)
+    {
+        // Worker builds keys in order: zero-padded, so the first entries come first
+        char prefix[16];
+        snprintf(prefix, sizeof(prefix), "%03d/", (int)i);
+        graphs.emplace_back(new RenderGraph(frag_files[i], sources, worker, quad_vbo, prefix));
+    }
+}
+
+Playlist::~Playlist()
+{
+    for (int i = 0; i < 2; ++i)
+    {
+        if (fade_fbo[i] != 0) render_state.delete_framebuffer(fade_fbo[i]);
+        if (fade_tex[i] != 0) render_state.delete_texture(fade_tex[i]);
+    }
+    if (mix_prog != 0) render_state.delete_program(mix_prog);
+}
+
+void Playlist::skip(int delta)
+{
+    int n = graphs.size();
+    skip_dir = delta < 0 ? -1 : 1;
+    wanted = ((wanted + delta) % n + n) % n;
+    // Waiting for a sketch that failed to build would hold up every switch after it
+    for (int i = 0; i < n && wanted != current && graphs[wanted]->has_failed(); ++i)
+        wanted = ((wanted + skip_dir) % n + n) % n;
+}
+
+bool Playlist::apply(const std::string &pass_name, const std::string &source, uint64_t reply_to, std::string &error)
+{
+    return graphs[current]->apply(pass_name, source, reply_to, error);
+}
+
+bool Playlist::set_uniform(const std::string &name, const GLfloat *vals, int n)
+{
+    UniformValue value;
+    if (n < 1 || n > (int)(sizeof(value.vals) / sizeof(value.vals[0]))) return false;
+    value.n = n;
+    for (int i = 0; i < n; ++i) value.vals[i] = vals[i];
+    inputs.uniforms[name] = value;
+    return true;
+}
+
+void Playlist::set_texture(const std::string &name, GLuint tex)
+{
+    inputs.textures[name] = tex;
+}
+
+void Playlist::take_reports(std::vector<BuildReport> &out)
+{
+    for (auto &graph : graphs) graph->take_reports(out);
+}
+
+void Playlist::update(float time)
+{
+    // Every file is polled once per frame, so a shared include rebuilds each dependent pass once
+    if (sources.update())
+        for (auto &graph : graphs) graph->check_files();
+
+    ShaderResult built;
+    while (worker.take_result(built))
+    {
+        bool taken = false;
+        for (size_t i = 0; i < graphs.size() && !taken; ++i) taken = graphs[i]->take_result(built);
+        // Superseded by a newer result or otherwise orphaned
+        if (!taken && built.prog != 0) render_state.delete_program(built.prog);
+    }
+
+    if (switch_time < 0) switch_time = time;
+    if (fading_from >= 0 && time - switch_time >= crossfade_secs) fading_from = -1;
+    if (switch_every_secs > 0 && wanted == current && fading_from < 0 && time - switch_time >= switch_every_secs) skip(1);
+
+    // Only switch to something that can draw right away
+    if (wanted != current && graphs[wanted]->has_failed())
+    {
+        printf("Sketch %d failed to build, skipping it                  \n", wanted);
+        skip(skip_dir);
+    }
+    if (wanted == current || !graphs[wanted]->is_ready()) return;
+    printf("Switching to sketch %d                                  \n", wanted);
+    fading_from = crossfade_secs > 0 ? current : -1;
+    current = wanted;
+    switch_time = time;
+}
+
+void Playlist::render(GLuint target_fbo, uint32_t width, uint32_t height, float time, float render_scale)
+{
+    if (fading_from < 0)
+    {
+        graphs[current]->render(target_fbo, width, height, time, render_scale, inputs);
+        return;
+    }
+
+    resize_fade(width, height);
+    graphs[fading_from]->render(fade_fbo[0], width, height, time, render_scale, inputs);
+    graphs[current]->render(fade_fbo[1], width, height, time, render_scale, inputs);
+
+    render_state.bind_framebuffer(target_fbo);
+    render_state.viewport(0, 0, width, height);
+    float t = (time - switch_time) / crossfade_secs;
+    if (t > 1) t = 1;
+    draw_mix(t * t * (3 - 2 * t));
+}
+
+void Playlist::resize_fade(uint32_t width, uint32_t height)
+{
+    if (width == fade_w && height == fade_h) return;
+    fade_w = width;
+    fade_h = height;
+    for (int i = 0; i < 2; ++i)
+    {
+        if (fade_tex[i] == 0) glGenTextures(1, &fade_tex[i]);
+        render_state.bind_texture(fade_tex[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        if (fade_fbo[i] != 0) continue;
+        glGenFramebuffers(1, &fade_fbo[i]);
+        render_state.bind_framebuffer(fade_fbo[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, fade_tex[i], 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) die("glCheckFramebufferStatus (crossfade)");
+    }
+}
+
+void Playlist::draw_mix(float amount)
+{
+    if (mix_prog == 0)
+    {
+        GLuint vs = compile_mix_shader(GL_VERTEX_SHADER, mix_vert);
+        GLuint fs = compile_mix_shader(GL_FRAGMENT_SHADER, mix_frag);
+        mix_prog = glCreateProgram();
+        glAttachShader(mix_prog, vs);
+        glAttachShader(mix_prog, fs);
+        glBindAttribLocation(mix_prog, 0, "a_pos");
+        glLinkProgram(mix_prog);
+        glDeleteShader(vs);
+        glDeleteShader(fs);
+        GLint ok = 0;
+        glGetProgramiv(mix_prog, GL_LINK_STATUS, &ok);
+        if (!ok) die("glLinkProgram (crossfade)");
+        mix_uniforms.reset(mix_prog);
+    }
+
+    bool blend = render_state.is_enabled(GL_BLEND);
+    render_state.set_enabled(GL_BLEND, false);
+    render_state.use_program(mix_prog);
+    mix_uniforms.set_int(mix_uniforms.find("from"), 0);
+    mix_uniforms.set_int(mix_uniforms.find("to"), 1);
+    mix_uniforms.set(mix_uniforms.find("amount"), amount);
+    render_state.bind_texture(fade_tex[0], 0);
+    render_state.bind_texture(fade_tex[1], 1);
+    render_state.vertex_attrib(0, quad_vbo, 2, GL_FLOAT);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    render_state.set_enabled(GL_BLEND, blend);
+}
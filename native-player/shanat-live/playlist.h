@@ -0,0 +1,71 @@
+#ifndef PLAYLIST_H
+#define PLAYLIST_H
+
+#include "../shanat-shared/render_state.h"
+#include "render_graph.h"
+#include "shader_sources.h"
+#include "shader_worker.h"
+
+#include <GLES2/gl2.h>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Set list of sketches, each a render graph kept resident with its programs linked, so
+// switching never waits for the compiler. All of them build in the background from the start
+// and stay hot-reloadable. A switch to a sketch that hasn't linked yet waits until it has;
+// one whose build failed is passed over.
+// With a crossfade, both sketches render into textures for its duration and get mixed.
+class Playlist
+{
+  private:
+    ShaderSources &sources;
+    ShaderWorker &worker;
+    const GLuint quad_vbo;
+    const float crossfade_secs;
+    const float switch_every_secs;
+    std::vector<std::unique_ptr<RenderGraph>> graphs;
+    int current = 0;
+    int wanted = 0;
+    // Direction of the last skip, to carry on in past sketches that failed to build
+    int skip_dir = 1;
+    // Sketch fading out, or -1
+    int fading_from = -1;
+    float switch_time = -1;
+
+    GLuint fade_tex[2] = {0, 0};
+    GLuint fade_fbo[2] = {0, 0};
+    uint32_t fade_w = 0;
+    uint32_t fade_h = 0;
+    GLuint mix_prog = 0;
+    ProgramUniforms mix_uniforms;
+    FrameInputs inputs;
+
+  private:
+    void resize_fade(uint32_t width, uint32_t height);
+    void draw_mix(float amount);
+
+  public:
+    // Playlist file: one fragment file per line, relative to the playlist; # starts a comment
+    static bool read(const std::string &path, std::vector<std::string> &frag_files);
+
+    Playlist(const std::vector<std::string> &frag_files, ShaderSources &sources, ShaderWorker &worker, GLuint quad_vbo,
+             float crossfade_secs = 0, float switch_every_secs = 0);
+    ~Playlist();
+    // Hot-reloads, programs from the worker, and switches that are due
+    void update(float time);
+    // Switches by this many entries, wrapping around
+    void skip(int delta);
+    // RenderGraph::apply() on the sketch showing now
+    bool apply(const std::string &pass_name, const std::string &source, uint64_t reply_to, std::string &error);
+    // Sets a float uniform, vector or array (up to 16 values) in every pass declaring it, from now on
+    bool set_uniform(const std::string &name, const GLfloat *vals, int n);
+    // Texture for sampler uniforms of this name in every pass, from now on
+    void set_texture(const std::string &name, GLuint tex);
+    // Build reports of every sketch since the last call
+    void take_reports(std::vector<BuildReport> &out);
+    void render(GLuint target_fbo, uint32_t width, uint32_t height, float time, float render_scale);
+};
+
+#endif
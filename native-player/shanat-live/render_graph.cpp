@@ -0,0 +1,459 @@
+#include "render_graph.h"
+#include "../shanat-shared/horrors.h"
+#include "../shanat-shared/trace.h"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+
+static const size_t max_passes = 8;
+
+static const char *blit_vert = R"(
+attribute vec2 a_pos;
+varying vec2 uv;
+void main() {
+    uv = a_pos * 0.5 + 0.5;
+    gl_Position = vec4(a_pos, 0.0, 1.0);
+}
+)";
+
+static const char *blit_frag = R"(
+precision mediump float;
+uniform sampler2D tex;
+varying vec2 uv;
+void main() {
+    gl_FragColor = texture2D(tex, uv);
+}
+)";
+
+static std::string manifest_path(const std::string &frag_file)
+{
+    size_t slash = frag_file.rfind('/');
+    size_t dot = frag_file.rfind('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return frag_file + ".passes";
+    return frag_file.substr(0, dot) + ".passes";
+}
+
+static bool is_identifier(const std::string &str)
+{
+    if (str.empty() || isdigit((unsigned char)str[0])) return false;
+    for (char c : str)
+        if (!isalnum((unsigned char)c) && c != '_') return false;
+    return true;
+}
+
+static GLuint compile_blit_shader(GLenum type, const char *src)
+{
+    GLuint s = glCreateShader(type);
+    glShaderSource(s, 1, &src, nullptr);
+    glCompileShader(s);
+    GLint ok = 0;
+    glGetShaderiv(s, GL_COMPILE_STATUS, &ok);
+    if (!ok) die("glCompileShader (pass blit)");
+    return s;
+}
+
+RenderGraph::RenderGraph(const std::string &frag_file, ShaderSources &sources, ShaderWorker &worker, GLuint quad_vbo,
+                         const std::string &key_prefix)
+    : sources(sources)
+    , worker(worker)
+    , quad_vbo(quad_vbo)
+    , key_prefix(key_prefix)
+{
+    std::string manifest = manifest_path(frag_file);
+    struct stat st;
+    if (stat(manifest.c_str(), &st) == 0) read_manifest(manifest);
+    else
+    {
+        RenderPass *pass = new RenderPass();
+        pass->name = "o0";
+        pass->frag_file = frag_file;
+        passes.emplace_back(pass);
+    }
+
+    for (auto &pass : passes) submit(*pass);
+}
+
+RenderGraph::~RenderGraph()
+{
+    for (auto &pass : passes)
+    {
+        if (pass->prog != 0) render_state.delete_program(pass->prog);
+        for (int i = 0; i < 2; ++i)
+        {
+            if (pass->fbo[i] != 0) render_state.delete_framebuffer(pass->fbo[i]);
+            if (pass->tex[i] != 0) render_state.delete_texture(pass->tex[i]);
+        }
+    }
+    if (blit_prog != 0) render_state.delete_program(blit_prog);
+}
+
+void RenderGraph::read_manifest(const std::string &path)
+{
+    FILE *f = fopen(path.c_str(), "r");
+    if (!f)
+    {
+        fprintf(stderr, "Cannot read pass manifest '%s'\n", path.c_str());
+        exit_with_cleanup(1);
+    }
+    printf("Reading passes from %s\n", path.c_str());
+
+    // Fragment files are relative to the manifest
+    size_t slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+
+    char line[512];
+    int line_nr = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), f))
+    {
+        ++line_nr;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+
+        std::vector<std::string> tokens;
+        for (char *tok = strtok(line, " \t\r\n"); tok; tok = strtok(nullptr, " \t\r\n")) tokens.push_back(tok);
+        if (tokens.empty()) continue;
+
+        RenderPass *pass = new RenderPass();
+        passes.emplace_back(pass);
+        pass->name = tokens[0];
+        if (tokens.size() < 2 || !is_identifier(pass->name))
+        {
+            fprintf(stderr, "%s:%d: expected pass name and fragment file\n", path.c_str(), line_nr);
+            ok = false;
+            break;
+        }
+        pass->frag_file = tokens[1][0] == '/' ? tokens[1] : dir + tokens[1];
+        for (size_t i = 2; i < tokens.size(); ++i)
+        {
+            if (tokens[i] == "feedback") pass->feedback = true;
+            else if (tokens[i].compare(0, 6, "scale=") == 0)
+            {
+                pass->scale = atof(tokens[i].c_str() + 6);
+                if (pass->scale <= 0 || pass->scale > 1)
+                {
+                    fprintf(stderr, "%s:%d: scale must be within (0, 1]\n", path.c_str(), line_nr);
+                    ok = false;
+                }
+            }
+            else
+            {
+                fprintf(stderr, "%s:%d: unknown option '%s'\n", path.c_str(), line_nr, tokens[i].c_str());
+                ok = false;
+            }
+        }
+        for (size_t i = 0; i + 1 < passes.size(); ++i)
+        {
+            if (passes[i]->name != pass->name) continue;
+            fprintf(stderr, "%s:%d: pass '%s' declared twice\n", path.c_str(), line_nr, pass->name.c_str());
+            ok = false;
+        }
+    }
+    fclose(f);
+
+    if (ok && passes.empty()) fprintf(stderr, "%s: no passes\n", path.c_str());
+    if (ok && passes.size() > max_passes) fprintf(stderr, "%s: at most %d passes\n", path.c_str(), (int)max_passes);
+    if (!ok || passes.empty() || passes.size() > max_passes) exit_with_cleanup(1);
+}
+
+void RenderGraph::submit(RenderPass &pass)
+{
+    std::string source, error;
+    if (!sources.expand(pass.frag_file, source, pass.deps, error))
+    {
+        fprintf(stderr, "Cannot preprocess %s, keeping current program: %s\n", pass.frag_file.c_str(), error.c_str());
+        pass.build_failed = true;
+        return;
+    }
+    // Touched, or an include changed in a way that doesn't reach us
+    if (source == pass.frag_content && pass.prog != 0) return;
+    pass.frag_content.swap(source);
+    pass.ticket = worker.submit(key_prefix + pass.name, pass.frag_content);
+    pass.build_failed = false;
+}
+
+bool RenderGraph::apply(const std::string &pass_name, const std::string &source, uint64_t reply_to, std::string &error)
+{
+    RenderPass *pass = pass_name.empty() ? passes.back().get() : nullptr;
+    for (auto &p : passes)
+        if (p->name == pass_name) pass = p.get();
+    if (!pass)
+    {
+        error = "No pass named '" + pass_name + "'";
+        return false;
+    }
+
+    std::string expanded;
+    if (!sources.expand(pass->frag_file, expanded, pass->deps, error, &source)) return false;
+    report_superseded(*pass);
+    pass->frag_content.swap(expanded);
+    pass->ticket = worker.submit(key_prefix + pass->name, pass->frag_content);
+    pass->build_failed = false;
+    pass->reply_ticket = pass->ticket;
+    pass->reply_to = reply_to;
+    return true;
+}
+
+// Answers a waiting apply request whose source won't be built anymore
+void RenderGraph::report_superseded(RenderPass &pass)
+{
+    if (pass.reply_to == 0) return;
+    BuildReport report;
+    report.file = pass.frag_file;
+    report.pass = pass.name;
+    report.log = "Superseded by newer source before it was built";
+    report.reply_to = pass.reply_to;
+    report.superseded = true;
+    reports.push_back(report);
+    pass.reply_to = 0;
+}
+
+void RenderGraph::take_reports(std::vector<BuildReport> &out)
+{
+    for (auto &report : reports) out.push_back(std::move(report));
+    reports.clear();
+}
+
+void RenderGraph::check_files()
+{
+    for (auto &pass : passes)
+    {
+        if (!sources.changed(pass->deps)) continue;
+        printf("File updated: %s                                      \n", pass->frag_file.c_str());
+        submit(*pass);
+    }
+}
+
+bool RenderGraph::take_result(ShaderResult &built)
+{
+    if (built.key.compare(0, key_prefix.size(), key_prefix) != 0) return false;
+    for (auto &pass : passes)
+    {
+        if (built.key.compare(key_prefix.size(), std::string::npos, pass->name) != 0) continue;
+        BuildReport report;
+        report.file = pass->frag_file;
+        report.pass = pass->name;
+        report.ok = built.prog != 0;
+        report.log = sources.annotate(built.log);
+        report.build_usec = built.build_usec;
+        // Tickets only go up: anything at or past the request's build answers it
+        if (pass->reply_to != 0 && built.ticket >= pass->reply_ticket)
+        {
+            report.reply_to = pass->reply_to;
+            report.superseded = built.ticket != pass->reply_ticket;
+            pass->reply_to = 0;
+        }
+
+        // Swap to a new program only once it has linked; keep drawing the old one otherwise
+        if (built.ticket == pass->ticket) pass->build_failed = built.prog == 0;
+        if (built.prog == 0)
+        {
+            fprintf(stderr, "Shader build failed for %s, keeping current program: %s\n",
+                    pass->frag_file.c_str(), report.log.c_str());
+        }
+        else install(*pass, built.prog);
+        reports.push_back(report);
+        return true;
+    }
+    return false;
+}
+
+bool RenderGraph::is_ready() const
+{
+    for (auto &pass : passes)
+        if (pass->prog == 0) return false;
+    return true;
+}
+
+bool RenderGraph::has_failed() const
+{
+    for (auto &pass : passes)
+        if (pass->prog == 0 && pass->build_failed) return true;
+    return false;
+}
+
+void RenderGraph::install(RenderPass &pass, GLuint prog)
+{
+    if (pass.prog != 0) render_state.delete_program(pass.prog);
+    pass.prog = prog;
+    pass.uniforms.reset(prog);
+    pass.time_ix = pass.uniforms.find("time");
+    pass.resolution_ix = pass.uniforms.find("resolution");
+    pass.render_scale_ix = pass.uniforms.find("render_scale");
+
+    pass.inputs.clear();
+    for (size_t i = 0; i < passes.size(); ++i)
+    {
+        int ix = pass.uniforms.find(passes[i]->name.c_str());
+        if (ix < 0) continue;
+        if (pass.inputs.size() == RenderState::max_texture_units)
+        {
+            fprintf(stderr, "Pass %s reads more than %d passes; ignoring %s\n",
+                    pass.name.c_str(), RenderState::max_texture_units, passes[i]->name.c_str());
+            continue;
+        }
+        pass.inputs.push_back(std::make_pair(ix, (int)i));
+    }
+    pass.input_frames.assign(pass.inputs.size(), -1);
+    pass.dirty = true;
+}
+
+void RenderGraph::resize(RenderPass &pass, uint32_t width, uint32_t height)
+{
+    width = (uint32_t)(width * pass.scale + 0.5f);
+    height = (uint32_t)(height * pass.scale + 0.5f);
+    if (width < 1) width = 1;
+    if (height < 1) height = 1;
+    if (width == pass.width && height == pass.height) return;
+
+    pass.width = width;
+    pass.height = height;
+    pass.cur = 0;
+    pass.dirty = true;
+    for (int i = 0; i < (pass.feedback ? 2 : 1); ++i)
+    {
+        if (pass.tex[i] == 0) glGenTextures(1, &pass.tex[i]);
+        render_state.bind_texture(pass.tex[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+        if (pass.fbo[i] == 0)
+        {
+            glGenFramebuffers(1, &pass.fbo[i]);
+            render_state.bind_framebuffer(pass.fbo[i]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pass.tex[i], 0);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) die("glCheckFramebufferStatus (pass)");
+        }
+        // Feedback starts from black, not from whatever the allocation held
+        render_state.bind_framebuffer(pass.fbo[i]);
+        render_state.viewport(0, 0, width, height);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+}
+
+bool RenderGraph::needs_run(const RenderPass &pass, const FrameInputs &extra) const
+{
+    if (pass.dirty || pass.feedback || pass.time_ix >= 0) return true;
+    // Values from outside can change any frame
+    for (auto &u : extra.uniforms)
+        if (pass.uniforms.find(u.first.c_str()) >= 0) return true;
+    for (auto &t : extra.textures)
+        if (pass.uniforms.find(t.first.c_str()) >= 0) return true;
+    // Reading itself without feedback gives black, which never changes
+    for (size_t i = 0; i < pass.inputs.size(); ++i)
+    {
+        const RenderPass &src = *passes[pass.inputs[i].second];
+        if (&src != &pass && src.rendered_frame != pass.input_frames[i]) return true;
+    }
+    return false;
+}
+
+void RenderGraph::draw(RenderPass &pass, bool offscreen, float time, float render_scale, const FrameInputs &extra)
+{
+    TRACE_SCOPE("pass");
+    render_state.use_program(pass.prog);
+    pass.uniforms.set(pass.time_ix, time);
+    pass.uniforms.set(pass.resolution_ix, (float)pass.width, (float)pass.height);
+    pass.uniforms.set(pass.render_scale_ix, render_scale);
+    for (auto &u : extra.uniforms) pass.uniforms.set_floats(pass.uniforms.find(u.first.c_str()), u.second.vals, u.second.n);
+    for (size_t unit = 0; unit < pass.inputs.size(); ++unit)
+    {
+        const RenderPass &src = *passes[pass.inputs[unit].second];
+        // Our own target can't be read while drawing into it; without feedback it reads black
+        GLuint tex = &src == &pass && !pass.feedback ? 0 : src.tex[src.cur];
+        render_state.bind_texture(tex, unit);
+        pass.uniforms.set_int(pass.inputs[unit].first, unit);
+        pass.input_frames[unit] = src.rendered_frame;
+    }
+    // Outside textures take the units after the passes'
+    int unit = pass.inputs.size();
+    for (auto &t : extra.textures)
+    {
+        int ix = pass.uniforms.find(t.first.c_str());
+        if (ix < 0 || unit == RenderState::max_texture_units) continue;
+        render_state.bind_texture(t.second, unit);
+        pass.uniforms.set_int(ix, unit++);
+    }
+
+    render_state.vertex_attrib(0, quad_vbo, 2, GL_FLOAT);
+    glClear(offscreen ? GL_COLOR_BUFFER_BIT : GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+
+    pass.rendered_frame = frame;
+    pass.dirty = false;
+}
+
+void RenderGraph::render(GLuint target_fbo, uint32_t width, uint32_t height, float time, float render_scale,
+                         const FrameInputs &extra)
+{
+    ++frame;
+    for (size_t i = 0; i < passes.size(); ++i)
+    {
+        RenderPass &pass = *passes[i];
+        bool offscreen = i + 1 < passes.size() || pass.feedback;
+        if (!offscreen)
+        {
+            render_state.bind_framebuffer(target_fbo);
+            render_state.viewport(0, 0, width, height);
+            pass.width = width;
+            pass.height = height;
+            // Nothing to draw until the first program has linked
+            if (pass.prog == 0) glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            else draw(pass, false, time, render_scale, extra);
+            continue;
+        }
+
+        resize(pass, width, height);
+        if (pass.prog == 0 || !needs_run(pass, extra)) continue;
+        int target = pass.feedback ? 1 - pass.cur : 0;
+        render_state.bind_framebuffer(pass.fbo[target]);
+        render_state.viewport(0, 0, pass.width, pass.height);
+        draw(pass, true, time, render_scale, extra);
+        pass.cur = target;
+    }
+
+    // Output pass with feedback went to its own texture
+    RenderPass &out = *passes.back();
+    if (out.feedback)
+    {
+        render_state.bind_framebuffer(target_fbo);
+        render_state.viewport(0, 0, width, height);
+        blit(out.tex[out.cur]);
+    }
+}
+
+void RenderGraph::blit(GLuint tex)
+{
+    if (blit_prog == 0)
+    {
+        GLuint vs = compile_blit_shader(GL_VERTEX_SHADER, blit_vert);
+        GLuint fs = compile_blit_shader(GL_FRAGMENT_SHADER, blit_frag);
+        blit_prog = glCreateProgram();
+        glAttachShader(blit_prog, vs);
+        glAttachShader(blit_prog, fs);
+        glBindAttribLocation(blit_prog, 0, "a_pos");
+        glLinkProgram(blit_prog);
+        glDeleteShader(vs);
+        glDeleteShader(fs);
+        GLint ok = 0;
+        glGetProgramiv(blit_prog, GL_LINK_STATUS, &ok);
+        if (!ok) die("glLinkProgram (pass blit)");
+        blit_uniforms.reset(blit_prog);
+    }
+
+    bool blend = render_state.is_enabled(GL_BLEND);
+    render_state.set_enabled(GL_BLEND, false);
+    render_state.use_program(blit_prog);
+    blit_uniforms.set_int(blit_uniforms.find("tex"), 0);
+    render_state.bind_texture(tex);
+    render_state.vertex_attrib(0, quad_vbo, 2, GL_FLOAT);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    render_state.set_enabled(GL_BLEND, blend);
+}
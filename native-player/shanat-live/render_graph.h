@@ -0,0 +1,150 @@
+#ifndef RENDER_GRAPH_H
+#define RENDER_GRAPH_H
+
+#include "../shanat-shared/render_state.h"
+#include "shader_sources.h"
+#include "shader_worker.h"
+
+#include <GLES2/gl2.h>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Uniforms set from outside, e.g. over the control socket, by name. Up to 16 floats, for a
+// float, vector or array uniform; passes that don't declare a uniform ignore it.
+struct UniformValue
+{
+    int n = 0;
+    GLfloat vals[16];
+};
+typedef std::map<std::string, UniformValue> UniformValues;
+
+// What a frame reads from outside the graph, besides time: uniforms, and textures such as the
+// audio spectrum that passes sample by name like they sample other passes
+struct FrameInputs
+{
+    UniformValues uniforms;
+    std::map<std::string, GLuint> textures;
+};
+
+// How a program build for a pass went, for whoever asked
+struct BuildReport
+{
+    std::string file;
+    std::string pass;
+    bool ok = false;
+    std::string log;
+    int64_t build_usec = 0;
+    // ControlServer reply handle of the apply request this answers, or 0
+    uint64_t reply_to = 0;
+    // Source from a newer submission got built instead of the requested one
+    bool superseded = false;
+};
+
+// One fullscreen fragment shader drawing into a texture of its own. Other passes (and the
+// pass itself, with feedback) read it through a sampler2D uniform named after the pass.
+struct RenderPass
+{
+    std::string name;
+    std::string frag_file;
+    // Fraction of the output size
+    float scale = 1;
+    // Ping-pong between two textures, so the pass can read its own previous frame
+    bool feedback = false;
+
+    // Expanded source last handed to the worker, and the files it came from
+    std::string frag_content;
+    std::vector<std::string> deps;
+    // Latest submission to the worker, and the apply request waiting for its result, if any
+    uint64_t ticket = 0;
+    uint64_t reply_ticket = 0;
+    uint64_t reply_to = 0;
+    // Latest source didn't preprocess or build, and nothing newer is on its way
+    bool build_failed = false;
+
+    GLuint prog = 0;
+    ProgramUniforms uniforms;
+    int time_ix = -1;
+    int resolution_ix = -1;
+    int render_scale_ix = -1;
+    // Sampler uniform handle and index of the pass it reads
+    std::vector<std::pair<int, int>> inputs;
+    // Each input's rendered_frame when we last drew; a later input draws after us in a frame,
+    // so comparing with our own rendered_frame would miss its changes every other frame
+    std::vector<int64_t> input_frames;
+
+    // tex[cur] has the latest output; tex[1] and fbo[1] only exist with feedback
+    GLuint tex[2] = {0, 0};
+    GLuint fbo[2] = {0, 0};
+    int cur = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    // Frame the output last changed, to tell readers whether they need to run again
+    int64_t rendered_frame = -1;
+    bool dirty = true;
+};
+
+// Passes declared in a manifest next to the fragment file: for "x.glsl", "x.passes" with one
+// pass per line, in drawing order:
+//
+//     # name  fragment-file  [scale=0.5] [feedback]
+//     o1      noise.glsl     scale=0.5
+//     o0      trail.glsl     feedback
+//
+// The last pass is the output. Reading a pass declared earlier sees this frame's output; a
+// later one (or itself, with feedback), the previous frame's. An offscreen pass only runs when
+// its program or size changed, it reads time, its own feedback or FrameInputs, or one of its
+// inputs ran.
+// Without a manifest the fragment file is the single output pass, drawn straight to the target.
+// The manifest is read once at startup; fragment files and their includes are watched, and a
+// pass is rebuilt when any file it's made of changes.
+class RenderGraph
+{
+  private:
+    ShaderSources &sources;
+    ShaderWorker &worker;
+    const GLuint quad_vbo;
+    // Worker keys are this plus the pass name, so several graphs can share a worker
+    const std::string key_prefix;
+    std::vector<std::unique_ptr<RenderPass>> passes;
+    int64_t frame = 0;
+    GLuint blit_prog = 0;
+    ProgramUniforms blit_uniforms;
+    std::vector<BuildReport> reports;
+
+  private:
+    void read_manifest(const std::string &path);
+    void submit(RenderPass &pass);
+    void install(RenderPass &pass, GLuint prog);
+    void resize(RenderPass &pass, uint32_t width, uint32_t height);
+    bool needs_run(const RenderPass &pass, const FrameInputs &extra) const;
+    void draw(RenderPass &pass, bool offscreen, float time, float render_scale, const FrameInputs &extra);
+    void report_superseded(RenderPass &pass);
+    void blit(GLuint tex);
+
+  public:
+    // Quad VBO holds the two sweep triangles that every pass draws
+    RenderGraph(const std::string &frag_file, ShaderSources &sources, ShaderWorker &worker, GLuint quad_vbo,
+                const std::string &key_prefix = "");
+    ~RenderGraph();
+    // Hands passes whose files changed in the last ShaderSources::update() to the worker
+    void check_files();
+    // Swaps in a program from the worker if it's for one of our passes; false if it isn't ours
+    bool take_result(ShaderResult &built);
+    // Builds source in place of a pass's file (empty name: the output pass) until the file
+    // changes again. The result is reported with reply_to. False with a message if it can't.
+    bool apply(const std::string &pass_name, const std::string &source, uint64_t reply_to, std::string &error);
+    // Moves reports of builds taken since the last call to the end of out
+    void take_reports(std::vector<BuildReport> &out);
+    // Every pass has a linked program
+    bool is_ready() const;
+    // Some pass has no program and won't get one until its files change
+    bool has_failed() const;
+    // Runs the passes that need it and leaves the output in target_fbo
+    void render(GLuint target_fbo, uint32_t width, uint32_t height, float time, float render_scale,
+                const FrameInputs &extra);
+};
+
+#endif
@@ -0,0 +1,225 @@
+#include "shader_sources.h"
+#include "../shanat-shared/trace.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Matches "#name arg" with any whitespace around the hash; arg is the rest, trimmed
+static bool parse_directive(const std::string &line, const char *name, std::string &arg)
+{
+    size_t i = line.find_first_not_of(" \t");
+    if (i == std::string::npos || line[i] != '#') return false;
+    i = line.find_first_not_of(" \t", i + 1);
+    size_t len = strlen(name);
+    if (i == std::string::npos || line.compare(i, len, name) != 0) return false;
+    i += len;
+    if (i < line.size() && !isspace((unsigned char)line[i])) return false;
+    size_t begin = line.find_first_not_of(" \t\r", i);
+    size_t end = line.find_last_not_of(" \t\r");
+    arg = begin == std::string::npos ? "" : line.substr(begin, end + 1 - begin);
+    return true;
+}
+
+void ShaderSources::add_dep(std::vector<SourceFile *> &deps, SourceFile *file)
+{
+    if (std::find(deps.begin(), deps.end(), file) == deps.end()) deps.push_back(file);
+}
+
+ShaderSources::SourceFile &ShaderSources::get(const std::string &path)
+{
+    auto it = files.find(path);
+    if (it != files.end()) return *it->second;
+
+    SourceFile *file = new SourceFile();
+    files[path].reset(file);
+    file->path = path;
+    file->id = by_id.size();
+    by_id.push_back(file);
+    file->hot_file.reset(new HotFile(path));
+    file->hot_file->check_update(file->content, file->modif);
+    file->changed_round = round;
+    if (verbose) printf("Watching shader file: %s\n", path.c_str());
+    if (verbose && file->modif == 0) printf("File appears to be missing\n");
+    return *file;
+}
+
+bool ShaderSources::update()
+{
+    TRACE_SCOPE("shader_sources_update");
+    ++round;
+    bool any = false;
+    for (auto &entry : files)
+    {
+        SourceFile &file = *entry.second;
+        if (!file.hot_file->check_update(file.content, file.modif)) continue;
+        file.changed_round = round;
+        any = true;
+    }
+    return any;
+}
+
+bool ShaderSources::changed(const std::vector<std::string> &deps) const
+{
+    for (auto &path : deps)
+    {
+        auto it = files.find(path);
+        if (it != files.end() && it->second->changed_round == round) return true;
+    }
+    return false;
+}
+
+bool ShaderSources::is_fresh(const SourceFile &file) const
+{
+    if (!file.has_expansion) return false;
+    for (auto dep : file.deps)
+        if (dep->changed_round > file.expanded_round) return false;
+    return true;
+}
+
+bool ShaderSources::expand_file(SourceFile &file, std::vector<SourceFile *> &stack, std::string &error)
+{
+    if (is_fresh(file)) return true;
+
+    file.has_expansion = false;
+    file.text.clear();
+    file.version.clear();
+    file.deps.assign(1, &file);
+    stack.push_back(&file);
+
+    size_t slash = file.path.rfind('/');
+    std::string dir = slash == std::string::npos ? "" : file.path.substr(0, slash + 1);
+    const size_t size = file.content.size();
+
+    bool ok = true;
+    int line_nr = 0;
+    std::string line, arg;
+    for (size_t pos = 0; ok && pos < size;)
+    {
+        size_t end = file.content.find('\n', pos);
+        if (end == std::string::npos) end = size;
+        line.assign(file.content, pos, end - pos);
+        pos = end + 1;
+        ++line_nr;
+
+        // #version has to come first in the whole source: expand() puts the root's there
+        if (parse_directive(line, "version", arg))
+        {
+            file.version = line;
+            file.text += '\n';
+            continue;
+        }
+        if (!parse_directive(line, "include", arg))
+        {
+            file.text += line;
+            file.text += '\n';
+            continue;
+        }
+
+        char msg[512];
+        if (arg.size() < 3 || arg[0] != '"' || arg.back() != '"')
+        {
+            snprintf(msg, sizeof(msg), "%s:%d: expected #include \"file\"", file.path.c_str(), line_nr);
+            error = msg;
+            ok = false;
+            break;
+        }
+        std::string name = arg.substr(1, arg.size() - 2);
+        SourceFile &child = get(name[0] == '/' ? name : dir + name);
+        add_dep(file.deps, &child);
+        if (std::find(stack.begin(), stack.end(), &child) != stack.end())
+        {
+            snprintf(msg, sizeof(msg), "%s:%d: include cycle through '%s'", file.path.c_str(), line_nr, child.path.c_str());
+            error = msg;
+            ok = false;
+        }
+        else if (child.modif == 0)
+        {
+            snprintf(msg, sizeof(msg), "%s:%d: cannot read '%s'", file.path.c_str(), line_nr, child.path.c_str());
+            error = msg;
+            ok = false;
+        }
+        else ok = expand_file(child, stack, error);
+        for (auto dep : child.deps) add_dep(file.deps, dep);
+        if (!ok) break;
+
+        file.text += "#line 1 " + std::to_string(child.id) + "\n";
+        file.text += child.text;
+        file.text += "#line " + std::to_string(line_nr + 1) + " " + std::to_string(file.id) + "\n";
+    }
+
+    stack.pop_back();
+    if (!ok) return false;
+    file.has_expansion = true;
+    file.expanded_round = round;
+    return true;
+}
+
+bool ShaderSources::expand(const std::string &root, std::string &source, std::vector<std::string> &deps, std::string &error,
+                           const std::string *content)
+{
+    TRACE_SCOPE("shader_expand");
+    SourceFile &root_file = get(root);
+    // Stand-in shares the root's path and number, so includes and the log come out the same,
+    // but its expansion isn't cached: it's gone once the file changes again
+    SourceFile standin;
+    if (content)
+    {
+        standin.path = root_file.path;
+        standin.id = root_file.id;
+        standin.content = *content;
+        standin.modif = 1;
+    }
+    SourceFile &file = content ? standin : root_file;
+
+    std::vector<SourceFile *> stack;
+    bool ok = file.modif != 0;
+    if (ok) ok = expand_file(file, stack, error);
+    else
+    {
+        file.deps.assign(1, &file);
+        error = "cannot read '" + root + "'";
+    }
+
+    deps.clear();
+    for (auto dep : file.deps) deps.push_back(dep->path);
+    if (!ok) return false;
+
+    source.clear();
+    if (!file.version.empty()) source = file.version + "\n";
+    source += "#line 1 " + std::to_string(file.id) + "\n";
+    source += file.text;
+    return true;
+}
+
+std::string ShaderSources::annotate(const std::string &log) const
+{
+    std::string out, line;
+    for (size_t pos = 0; pos < log.size();)
+    {
+        size_t end = log.find('\n', pos);
+        if (end == std::string::npos) end = log.size();
+        line.assign(log, pos, end - pos);
+        pos = end + 1;
+
+        // First number starting a word, if it's followed by a line number: "0:12(5):", "ERROR: 0:12:", "0(12) :"
+        for (size_t i = 0; i < line.size(); ++i)
+        {
+            if (!isdigit((unsigned char)line[i])) continue;
+            if (i > 0 && line[i - 1] != ' ') break;
+            size_t j = i;
+            while (j < line.size() && isdigit((unsigned char)line[j])) ++j;
+            if (j + 1 < line.size() && (line[j] == ':' || line[j] == '(') && isdigit((unsigned char)line[j + 1]))
+            {
+                size_t id = atoi(line.c_str() + i);
+                if (id < by_id.size()) line.replace(i, j - i, by_id[id]->path);
+            }
+            break;
+        }
+        out += line;
+        if (end < log.size()) out += '\n';
+    }
+    return out;
+}
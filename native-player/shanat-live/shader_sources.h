@@ -0,0 +1,70 @@
+#ifndef SHADER_SOURCES_H
+#define SHADER_SOURCES_H
+
+#include "hot_file.h"
+
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// Fragment shader files with everything they pull in through #include "file", which is
+// relative to the including file. Every file in the graph is watched and gets a GLSL source
+// string number; expansions wrap each included file in #line directives, so compile errors
+// carry the right file and line, and annotate() turns the numbers back into file names.
+// Expansions are cached per file until the file or something it includes changes, so a
+// library shared by many sketches is expanded once per edit, not once per sketch.
+class ShaderSources
+{
+  private:
+    struct SourceFile
+    {
+        std::string path;
+        // Source string number in #line directives
+        int id = 0;
+        std::unique_ptr<HotFile> hot_file;
+        std::string content;
+        int64_t modif = 0;
+        // Round of update() in which the content last changed
+        uint64_t changed_round = 0;
+
+        // Cached expansion; stale once anything in deps changed after expanded_round
+        bool has_expansion = false;
+        uint64_t expanded_round = 0;
+        std::string text;
+        std::string version;
+        std::vector<SourceFile *> deps;
+    };
+
+    std::map<std::string, std::unique_ptr<SourceFile>> files;
+    std::vector<SourceFile *> by_id;
+    uint64_t round = 0;
+    // Announce each file as it's first watched
+    const bool verbose;
+
+  private:
+    static void add_dep(std::vector<SourceFile *> &deps, SourceFile *file);
+    SourceFile &get(const std::string &path);
+    bool is_fresh(const SourceFile &file) const;
+    bool expand_file(SourceFile &file, std::vector<SourceFile *> &stack, std::string &error);
+
+  public:
+    explicit ShaderSources(bool verbose = true)
+        : verbose(verbose)
+    {
+    }
+    // Polls every watched file once; true if any of them changed
+    bool update();
+    // Whether any of these files changed in the last update()
+    bool changed(const std::vector<std::string> &deps) const;
+    // Source ready for the compiler, and every file it was made of (root included, even on
+    // failure, so a missing include gets picked up when it appears). False with a message on error.
+    // With content, that stands in for the root file's own, e.g. source pushed over a socket.
+    bool expand(const std::string &root, std::string &source, std::vector<std::string> &deps, std::string &error,
+                const std::string *content = nullptr);
+    // Compiler log with source string numbers replaced by file names
+    std::string annotate(const std::string &log) const;
+};
+
+#endif
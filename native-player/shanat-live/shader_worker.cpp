@@ -0,0 +1,288 @@
+#include "shader_worker.h"
+#include "../shanat-shared/fps.h"
+#include "../shanat-shared/horrors.h"
+#include "../shanat-shared/trace.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static void get_shader_log(GLuint s, std::string &log)
+{
+    GLint len = 0;
+    glGetShaderiv(s, GL_INFO_LOG_LENGTH, &len);
+    log.assign(len ? len : 1, '\0');
+    glGetShaderInfoLog(s, len, nullptr, &log[0]);
+    log.resize(strlen(log.c_str()));
+}
+
+static void get_program_log(GLuint prog, std::string &log)
+{
+    GLint len = 0;
+    glGetProgramiv(prog, GL_INFO_LOG_LENGTH, &len);
+    log.assign(len ? len : 1, '\0');
+    glGetProgramInfoLog(prog, len, nullptr, &log[0]);
+    log.resize(strlen(log.c_str()));
+}
+
+static GLuint compile_shader(GLenum type, const char *src, std::string &log)
+{
+    TRACE_SCOPE("compile_shader");
+    GLuint s = glCreateShader(type);
+    glShaderSource(s, 1, &src, nullptr);
+    glCompileShader(s);
+    GLint ok = 0;
+    glGetShaderiv(s, GL_COMPILE_STATUS, &ok);
+    if (!ok)
+    {
+        get_shader_log(s, log);
+        glDeleteShader(s);
+        return 0;
+    }
+    return s;
+}
+
+// GLSL ES 3.x if there's a "#version 300 es" or later; 1.00 otherwise
+static bool is_glsl_es3(const std::string &src)
+{
+    size_t pos = src.find("#version");
+    if (pos == std::string::npos) return false;
+    return atoi(src.c_str() + pos + 8) >= 300;
+}
+
+ShaderWorker::ShaderWorker(const char *vert_src, const char *legacy_vert_src, ProgramCache *cache)
+    : vert_src(vert_src)
+    , legacy_vert_src(legacy_vert_src)
+    , cache(cache)
+{
+    ctx = create_shared_context();
+    if (ctx == EGL_NO_CONTEXT)
+    {
+        printf("No surfaceless shared context; compiling shaders on the render thread\n");
+        return;
+    }
+
+    if (pthread_create(&thread, nullptr, worker_fun, this) != 0)
+    {
+        fprintf(stderr, "Failed to start shader worker thread\n");
+        exit_with_cleanup(1);
+    }
+}
+
+ShaderWorker::~ShaderWorker()
+{
+    if (is_async())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        cond.notify_all();
+        pthread_join(thread, nullptr);
+        eglDestroyContext(egl_display, ctx);
+        ctx = EGL_NO_CONTEXT;
+        return;
+    }
+
+    // Synchronous mode: objects live in the render context, which is current here
+    delete_leftovers();
+}
+
+void ShaderWorker::delete_leftovers()
+{
+    // After a failure the render thread may still be taking results until it notices
+    std::map<std::string, ShaderResult> left;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        left.swap(results);
+    }
+    for (auto &it : left)
+        if (it.second.prog != 0) glDeleteProgram(it.second.prog);
+    if (vs != 0) glDeleteShader(vs);
+    if (legacy_vs != 0) glDeleteShader(legacy_vs);
+    vs = legacy_vs = 0;
+}
+
+void *ShaderWorker::worker_fun(void *arg)
+{
+    ShaderWorker &sw = *(ShaderWorker *)arg;
+    trace_thread_name("shader_worker");
+
+    if (!eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, sw.ctx))
+    {
+        fprintf(stderr, "Shader worker failed to make its context current\n");
+        sw.fail();
+        return nullptr;
+    }
+
+    std::string frag_src;
+    while (true)
+    {
+        ShaderResult res;
+        {
+            std::unique_lock<std::mutex> lock(sw.mutex);
+            sw.cond.wait(lock, [&sw] { return !sw.jobs.empty() || !sw.running; });
+            if (!sw.running) break;
+            auto it = sw.jobs.begin();
+            res.key = it->first;
+            frag_src.swap(it->second.first);
+            res.ticket = it->second.second;
+            sw.jobs.erase(it);
+            sw.busy = true;
+        }
+
+        sw.build(frag_src, res);
+        // The render context may only use the program once its build has completed here
+        glFinish();
+        sw.publish(res);
+        {
+            std::lock_guard<std::mutex> lock(sw.mutex);
+            sw.busy = false;
+            if (sw.failed) break;
+        }
+        sw.cond.notify_all();
+    }
+
+    // Nobody will collect a result anymore
+    sw.delete_leftovers();
+    glFinish();
+    eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglReleaseThread();
+    return nullptr;
+}
+
+void ShaderWorker::build(const std::string &frag_src, ShaderResult &res)
+{
+    TRACE_SCOPE("build_program");
+    int64_t start_usec = monotonic_usec();
+    res.prog = 0;
+    res.log.clear();
+    build_program(frag_src, res);
+    res.build_usec = monotonic_usec() - start_usec;
+}
+
+void ShaderWorker::build_program(const std::string &frag_src, ShaderResult &res)
+{
+    if (cache)
+    {
+        const std::string &vsrc = is_glsl_es3(frag_src) ? vert_src : legacy_vert_src;
+        res.prog = cache->load(vsrc.c_str(), frag_src.c_str());
+        if (res.prog != 0) return;
+    }
+
+    // Vertex shaders never change; compile each once and reuse
+    bool es3 = is_glsl_es3(frag_src);
+    const std::string &vsrc = es3 ? vert_src : legacy_vert_src;
+    GLuint &vs = es3 ? this->vs : legacy_vs;
+    if (vs == 0)
+    {
+        vs = compile_shader(GL_VERTEX_SHADER, vsrc.c_str(), res.log);
+        if (vs == 0)
+        {
+            fprintf(stderr, "Vertex shader compile error: %s\n", res.log.c_str());
+            fail();
+            return;
+        }
+    }
+
+    GLuint fs = compile_shader(GL_FRAGMENT_SHADER, frag_src.c_str(), res.log);
+    if (fs == 0) return;
+
+    GLuint prog = glCreateProgram();
+    glAttachShader(prog, vs);
+    glAttachShader(prog, fs);
+    const GLint ixPosAttribute = 0;
+    glBindAttribLocation(prog, ixPosAttribute, "a_pos");
+    GLint ok = 0;
+    {
+        TRACE_SCOPE("link_program");
+        glLinkProgram(prog);
+        glGetProgramiv(prog, GL_LINK_STATUS, &ok);
+    }
+    // Program keeps what it needs; shader object goes when the program does
+    glDetachShader(prog, fs);
+    glDeleteShader(fs);
+    if (!ok)
+    {
+        get_program_log(prog, res.log);
+        glDeleteProgram(prog);
+        return;
+    }
+    res.prog = prog;
+    if (cache) cache->store(prog, vsrc.c_str(), frag_src.c_str());
+}
+
+void ShaderWorker::publish(ShaderResult &res)
+{
+    GLuint stale = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        // Render loop hasn't picked up the previous one for this key: it's superseded
+        auto it = results.find(res.key);
+        if (it != results.end()) stale = it->second.prog;
+        ShaderResult &slot = results[res.key];
+        slot.key = res.key;
+        slot.ticket = res.ticket;
+        slot.prog = res.prog;
+        slot.log.swap(res.log);
+        slot.build_usec = res.build_usec;
+    }
+    if (stale != 0) glDeleteProgram(stale);
+}
+
+uint64_t ShaderWorker::submit(const std::string &key, const std::string &frag_src)
+{
+    if (!is_async())
+    {
+        ShaderResult res;
+        res.key = key;
+        res.ticket = ++last_ticket;
+        build(frag_src, res);
+        publish(res);
+        return res.ticket;
+    }
+
+    uint64_t ticket;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ticket = ++last_ticket;
+        jobs[key] = std::make_pair(frag_src, ticket);
+    }
+    cond.notify_all();
+    return ticket;
+}
+
+void ShaderWorker::wait_idle()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    cond.wait(lock, [this] { return (jobs.empty() && !busy) || failed; });
+}
+
+void ShaderWorker::fail()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        failed = true;
+    }
+    cond.notify_all();
+}
+
+bool ShaderWorker::has_failed()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return failed;
+}
+
+bool ShaderWorker::take_result(ShaderResult &res)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (results.empty()) return false;
+    auto it = results.begin();
+    res.key = it->first;
+    res.ticket = it->second.ticket;
+    res.prog = it->second.prog;
+    res.log.swap(it->second.log);
+    res.build_usec = it->second.build_usec;
+    results.erase(it);
+    return true;
+}
@@ -0,0 +1,79 @@
+#ifndef SHADER_WORKER_H
+#define SHADER_WORKER_H
+
+#include "../shanat-shared/program_cache.h"
+
+#include <EGL/egl.h>
+#include <GLES2/gl2.h>
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+
+struct ShaderResult
+{
+    // Which submission this is for
+    std::string key;
+    uint64_t ticket = 0;
+    // Linked program, or 0 if compile or link failed
+    GLuint prog = 0;
+    std::string log;
+    // Compile and link, or loading from the cache
+    int64_t build_usec = 0;
+};
+
+// Compiles and links fragment shaders against a fixed vertex shader on a thread of its own,
+// with an EGL context that shares objects with the render context. The render loop keeps
+// drawing with its current program and swaps only when a linked one comes back.
+// If the display can't give us a surfaceless shared context, builds on the caller's thread.
+class ShaderWorker
+{
+  private:
+    // Vertex shader must match the fragment shader's GLSL version: GLSL ES 3.x and 1.00
+    const std::string vert_src;
+    const std::string legacy_vert_src;
+    ProgramCache *const cache;
+    EGLContext ctx = EGL_NO_CONTEXT;
+    pthread_t thread = 0;
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool running = true;
+    bool busy = false;
+    // Building can't go on; the render loop shuts down rather than us tearing down under it
+    bool failed = false;
+    uint64_t last_ticket = 0;
+    // Source and ticket by key
+    std::map<std::string, std::pair<std::string, uint64_t>> jobs;
+    std::map<std::string, ShaderResult> results;
+    GLuint vs = 0;
+    GLuint legacy_vs = 0;
+
+  private:
+    static void *worker_fun(void *arg);
+    void build(const std::string &frag_src, ShaderResult &res);
+    void build_program(const std::string &frag_src, ShaderResult &res);
+    void publish(ShaderResult &res);
+    void delete_leftovers();
+    void fail();
+
+  public:
+    // Cache, if any, is only touched from the thread doing the builds
+    ShaderWorker(const char *vert_src, const char *legacy_vert_src, ProgramCache *cache = nullptr);
+    // Must run while the EGL display is still up, i.e. before cleanup_horrors()
+    ~ShaderWorker();
+    // Queues a fragment shader; replaces one with the same key still waiting for the worker.
+    // Returns the ticket its result will carry; tickets only go up.
+    uint64_t submit(const std::string &key, const std::string &frag_src);
+    // Non-blocking; true if a build finished since the last call. Caller owns res.prog.
+    bool take_result(ShaderResult &res);
+    // Blocks until everything submitted so far has been built, or the worker has failed
+    void wait_idle();
+    // True once the worker can't build anymore, e.g. the vertex shader didn't compile
+    bool has_failed();
+    bool is_async() const { return ctx != EGL_NO_CONTEXT; }
+};
+
+#endif
@@ -0,0 +1,488 @@
+#include "../shanat-live/hot_file.h"
+#include "../shanat-shared/arg_parse.h"
+#include "../shanat-shared/fps.h"
+#include "../shanat-shared/frame_stats.h"
+#include "../shanat-shared/geo.h"
+#include "../shanat-shared/json.h"
+#include "../shanat-shared/simd.h"
+#include "../shanat-sketches/lissaj/lissaj.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <memory>
+#include <string.h>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+static std::string filter;
+static int reps;
+static int warmup_msec;
+static int min_sample_usec;
+static std::string out_file;
+
+// One benchmark at one problem size. setup() runs once before timing; run(n) does the
+// operation n times.
+struct Case
+{
+    std::string name;
+    int size;
+    std::function<void()> setup;
+    std::function<void(int64_t)> run;
+    std::function<void()> teardown;
+};
+
+struct CaseResult
+{
+    std::string name;
+    int size = 0;
+    int64_t iters = 0;
+    // Per operation, over the repetitions
+    double median_ns = 0;
+    double mad_ns = 0;
+    double min_ns = 0;
+    double p90_ns = 0;
+    double inlier_mean_ns = 0;
+    int outliers = 0;
+    // Negative without a cycle counter
+    double median_cycles = -1;
+};
+
+// Keeps the compiler from optimizing away work whose result nobody reads
+static inline void clobber(const void *p)
+{
+    asm volatile("" : : "g"(p) : "memory");
+}
+
+static int64_t now_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Core cycles of this thread through perf, where the kernel lets us; -1 otherwise
+class CycleCounter
+{
+  private:
+    int fd = -1;
+
+  public:
+    CycleCounter()
+    {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    ~CycleCounter()
+    {
+        if (fd >= 0) close(fd);
+    }
+    bool available() const { return fd >= 0; }
+    int64_t read_count() const
+    {
+        int64_t count = -1;
+        if (fd < 0 || read(fd, &count, sizeof(count)) != sizeof(count)) return -1;
+        return count;
+    }
+};
+
+static const char *simd_name()
+{
+#if defined(SHANAT_SSE)
+    return "sse";
+#elif defined(SHANAT_NEON)
+    return "neon";
+#else
+    return "scalar";
+#endif
+}
+
+static const char *arch_name()
+{
+#if defined(__x86_64__)
+    return "x86_64";
+#elif defined(__aarch64__)
+    return "aarch64";
+#elif defined(__arm__)
+    return "arm";
+#else
+    return "unknown";
+#endif
+}
+
+// Value at fraction q of sorted vals, interpolated
+static double quantile(const std::vector<double> &sorted, double q)
+{
+    double pos = q * (sorted.size() - 1);
+    size_t lo = (size_t)pos;
+    size_t hi = lo + 1 < sorted.size() ? lo + 1 : lo;
+    return sorted[lo] + (sorted[hi] - sorted[lo]) * (pos - lo);
+}
+
+static CaseResult measure(Case &c, const CycleCounter &cycles)
+{
+    CaseResult res;
+    res.name = c.name;
+    res.size = c.size;
+    if (c.setup) c.setup();
+
+    // Grow the batch until one sample takes long enough for the clock to resolve it
+    int64_t iters = 1;
+    while (true)
+    {
+        int64_t start = now_ns();
+        c.run(iters);
+        int64_t elapsed = now_ns() - start;
+        if (elapsed >= min_sample_usec * 1000LL || iters >= (1LL << 40)) break;
+        iters *= elapsed > 0 && min_sample_usec * 1000LL / elapsed < 10 ? 2 : 10;
+    }
+    res.iters = iters;
+
+    // Warm caches, branch predictors and the CPU's clock
+    for (int64_t until = now_ns() + warmup_msec * 1000000LL; now_ns() < until;) c.run(iters);
+
+    std::vector<double> ns(reps), cyc;
+    for (int r = 0; r < reps; ++r)
+    {
+        int64_t c0 = cycles.read_count();
+        int64_t start = now_ns();
+        c.run(iters);
+        int64_t elapsed = now_ns() - start;
+        int64_t c1 = cycles.read_count();
+        ns[r] = (double)elapsed / iters;
+        if (c0 >= 0 && c1 >= c0) cyc.push_back((double)(c1 - c0) / iters);
+    }
+    if (c.teardown) c.teardown();
+
+    // Median and median absolute deviation shrug off the odd preempted sample
+    std::vector<double> sorted(ns);
+    std::sort(sorted.begin(), sorted.end());
+    res.median_ns = quantile(sorted, 0.5);
+    res.min_ns = sorted.front();
+    res.p90_ns = quantile(sorted, 0.9);
+    std::vector<double> dev;
+    for (double v : sorted) dev.push_back(fabs(v - res.median_ns));
+    std::sort(dev.begin(), dev.end());
+    res.mad_ns = quantile(dev, 0.5);
+
+    // Outside 3 scaled MADs (about 3 sigma for normal noise) counts as an outlier
+    double limit = 3 * 1.4826 * res.mad_ns;
+    double sum = 0;
+    int inliers = 0;
+    for (double v : sorted)
+    {
+        if (fabs(v - res.median_ns) > limit && limit > 0) continue;
+        sum += v;
+        ++inliers;
+    }
+    res.outliers = reps - inliers;
+    res.inlier_mean_ns = inliers > 0 ? sum / inliers : res.median_ns;
+
+    if (!cyc.empty())
+    {
+        std::sort(cyc.begin(), cyc.end());
+        res.median_cycles = quantile(cyc, 0.5);
+    }
+    return res;
+}
+
+static void add_geo_cases(std::vector<Case> &cases)
+{
+    std::shared_ptr<Mat4> a(new Mat4()), b(new Mat4()), res(new Mat4());
+    for (int i = 0; i < 16; ++i)
+    {
+        a->vals[i] = (i * 7 % 11) * 0.1f + (i % 5 == 0 ? 2 : 0);
+        b->vals[i] = (i * 3 % 13) * 0.05f;
+    }
+
+    cases.push_back({"geo_multiply", 1, nullptr, [=](int64_t n) {
+                         for (int64_t i = 0; i < n; ++i)
+                         {
+                             multiply(*a, *b, *res);
+                             clobber(res.get());
+                         }
+                     },
+                     nullptr});
+    cases.push_back({"geo_inverse", 1, nullptr, [=](int64_t n) {
+                         for (int64_t i = 0; i < n; ++i)
+                         {
+                             inverse(*a, *res);
+                             clobber(res.get());
+                         }
+                     },
+                     nullptr});
+    cases.push_back({"geo_look_at_perspective", 1, nullptr, [=](int64_t n) {
+                         Vec3 eye, target, up;
+                         target.set(0, 0, 0);
+                         up.set(0, 1, 0);
+                         for (int64_t i = 0; i < n; ++i)
+                         {
+                             eye.set(3 * sinf(i * 0.01f), 2, 3 * cosf(i * 0.01f));
+                             lookAt(eye, target, up, *a);
+                             perspective(50, 1.25f, 0.1f, 100, *b);
+                             multiply(*b, *a, *res);
+                             clobber(res.get());
+                         }
+                     },
+                     nullptr});
+
+    for (int count : {128, 1024, 16384})
+    {
+        std::shared_ptr<std::vector<float>> in(new std::vector<float>(count * 4)), out(new std::vector<float>(count * 4));
+        for (int i = 0; i < count * 4; ++i) (*in)[i] = (i % 17) * 0.1f;
+        cases.push_back({"geo_transform_points", count, nullptr, [=](int64_t n) {
+                             for (int64_t i = 0; i < n; ++i)
+                             {
+                                 transformPoints(*a, &(*in)[0], &(*out)[0], count);
+                                 clobber(&(*out)[0]);
+                             }
+                         },
+                         nullptr});
+    }
+}
+
+static void add_lissaj_cases(std::vector<Case> &cases)
+{
+    cases.push_back({"lissaj_update_points", LissajModel::nAllPts, nullptr, [](int64_t n) {
+                         for (int64_t i = 0; i < n; ++i)
+                         {
+                             LissajModel::updatePoints(i * 0.001f);
+                             clobber(LissajModel::pts);
+                         }
+                     },
+                     nullptr});
+}
+
+static void add_fps_cases(std::vector<Case> &cases)
+{
+    // frame_end() sleeps until the next slot by design; record_frame() is the rest of it
+    std::shared_ptr<std::unique_ptr<FPS>> fps(new std::unique_ptr<FPS>());
+    for (int window : {25, 60, 250})
+    {
+        cases.push_back({"fps_avg_work_usec", window, [=]() {
+                             // Window length is the target FPS; fill every slot of it
+                             fps->reset(new FPS(window));
+                             for (int i = 0; i < window; ++i)
+                             {
+                                 (*fps)->frame_start();
+                                 (*fps)->work_done();
+                                 (*fps)->record_frame();
+                             }
+                         },
+                         [=](int64_t n) {
+                             volatile long sink = 0;
+                             for (int64_t i = 0; i < n; ++i) sink = (*fps)->get_avg_work_usec();
+                             (void)sink;
+                         },
+                         [=]() { fps->reset(); }});
+    }
+    cases.push_back({"fps_frame_bookkeeping", 1, [=]() { fps->reset(new FPS(25)); }, [=](int64_t n) {
+                         for (int64_t i = 0; i < n; ++i)
+                         {
+                             volatile float t = (*fps)->frame_start();
+                             (void)t;
+                             (*fps)->work_done(0);
+                             (*fps)->record_frame();
+                         }
+                     },
+                     [=]() { fps->reset(); }});
+
+    // Long interval: the publisher thread stays quiet while we measure
+    std::shared_ptr<std::unique_ptr<FrameStats>> stats(new std::unique_ptr<FrameStats>());
+    cases.push_back({"frame_stats_record", 1, [=]() { stats->reset(new FrameStats("", 3600 * 1000)); }, [=](int64_t n) {
+                         for (int64_t i = 0; i < n; ++i) (*stats)->record(30000 + (i & 1023), 40000, (i & 63) == 0);
+                     },
+                     [=]() { stats->reset(); }});
+}
+
+// Render thread's check_update() while other threads hammer the same HotFile
+static void add_hot_file_cases(std::vector<Case> &cases, const std::string &dir)
+{
+    struct State
+    {
+        std::string fname;
+        std::unique_ptr<HotFile> hf;
+        std::vector<std::thread> threads;
+        std::atomic<bool> stop;
+        std::string content;
+        int64_t modif = 0;
+    };
+
+    auto make_setup = [dir](std::shared_ptr<State> st, int file_bytes, int contenders) {
+        return [=]() {
+            st->fname = dir + "/hot_" + std::to_string(file_bytes) + ".glsl";
+            FILE *f = fopen(st->fname.c_str(), "w");
+            if (!f)
+            {
+                fprintf(stderr, "Cannot write '%s'\n", st->fname.c_str());
+                exit(1);
+            }
+            std::string body(file_bytes, 'x');
+            fwrite(body.data(), 1, body.size(), f);
+            fclose(f);
+            st->hf.reset(new HotFile(st->fname));
+            st->hf->check_update(st->content, st->modif);
+            st->stop = false;
+            for (int t = 0; t < contenders; ++t)
+            {
+                st->threads.push_back(std::thread([st]() {
+                    std::string content;
+                    int64_t modif = 0;
+                    st->hf->check_update(content, modif);
+                    while (!st->stop) st->hf->check_update(content, modif);
+                }));
+            }
+        };
+    };
+    auto teardown = [](std::shared_ptr<State> st) {
+        return [=]() {
+            st->stop = true;
+            for (auto &t : st->threads) t.join();
+            st->threads.clear();
+            st->hf.reset();
+            // Leaves the directory empty for main() to remove
+            unlink(st->fname.c_str());
+        };
+    };
+
+    // Up to date: what the render thread does nearly every frame
+    for (int contenders : {0, 1, 3})
+    {
+        std::shared_ptr<State> st(new State());
+        cases.push_back({"hot_file_check_update", contenders, make_setup(st, 4096, contenders), [=](int64_t n) {
+                             for (int64_t i = 0; i < n; ++i) st->hf->check_update(st->content, st->modif);
+                         },
+                         teardown(st)});
+    }
+    // Stale: every call copies the content out
+    for (int bytes : {1024, 65536})
+    {
+        std::shared_ptr<State> st(new State());
+        cases.push_back({"hot_file_check_update_copy", bytes, make_setup(st, bytes, 0), [=](int64_t n) {
+                             for (int64_t i = 0; i < n; ++i)
+                             {
+                                 int64_t stale = 0;
+                                 st->hf->check_update(st->content, stale);
+                                 clobber(st->content.data());
+                             }
+                         },
+                         teardown(st)});
+    }
+}
+
+static std::string result_json(const CaseResult &r)
+{
+    char buf[512];
+    char cycles[32] = "null";
+    if (r.median_cycles >= 0) snprintf(cycles, sizeof(cycles), "%.2f", r.median_cycles);
+    snprintf(buf, sizeof(buf),
+             ",\"size\":%d,\"iters\":%lld,\"reps\":%d,\"median_ns\":%.3f,\"mad_ns\":%.3f,\"min_ns\":%.3f,"
+             "\"p90_ns\":%.3f,\"mean_ns\":%.3f,\"outliers\":%d,\"median_cycles\":%s}",
+             r.size, (long long)r.iters, reps, r.median_ns, r.mad_ns, r.min_ns, r.p90_ns, r.inlier_mean_ns, r.outliers,
+             cycles);
+    return "{\"name\":" + json_string(r.name) + buf;
+}
+
+static void write_json(const std::vector<CaseResult> &results)
+{
+    FILE *f = fopen(out_file.c_str(), "w");
+    if (!f)
+    {
+        fprintf(stderr, "Cannot write '%s'\n", out_file.c_str());
+        exit(1);
+    }
+    fprintf(f, "{\n\"arch\":\"%s\",\n\"simd\":\"%s\",\n\"cpus\":%u,\n\"results\":[\n", arch_name(), simd_name(),
+            std::thread::hardware_concurrency());
+    for (size_t i = 0; i < results.size(); ++i)
+        fprintf(f, "%s%s\n", result_json(results[i]).c_str(), i + 1 < results.size() ? "," : "");
+    fprintf(f, "]\n}\n");
+    fclose(f);
+}
+
+static void parse_args(int argc, const char *argv[])
+{
+    auto parser = ArgumentParser("shanat-microbench");
+    parser.add_argument("help", "--help", "", "Displays this help message");
+    parser.add_argument("filter", "--filter", "", "Only run benchmarks whose name contains this", STORE);
+    parser.add_argument("reps", "--reps", "", "Timed samples per benchmark (default: 30)", STORE, "30");
+    parser.add_argument("warmup", "--warmup", "", "Milliseconds of warmup per benchmark (default: 100)", STORE, "100");
+    parser.add_argument("min_sample", "--min-sample", "", "Shortest sample in usec; sets the batch size (default: 2000)", STORE, "2000");
+    parser.add_argument("out", "--out", "", "Write results as JSON to this file", STORE);
+
+    bool success = parser.parse(argv, argc, stdout);
+    if (!success || parser.get("help").is_set)
+    {
+        parser.print_usage(stdout);
+        exit(success ? 0 : 1);
+    }
+
+    if (parser.get("filter").is_set) filter = parser.get("filter").value;
+    if (parser.get("out").is_set) out_file = parser.get("out").value;
+    reps = atoi(parser.get("reps").value.c_str());
+    warmup_msec = atoi(parser.get("warmup").value.c_str());
+    min_sample_usec = atoi(parser.get("min_sample").value.c_str());
+    if (reps < 3 || warmup_msec < 0 || min_sample_usec < 1)
+    {
+        fprintf(stderr, "Need at least 3 reps, a non-negative warmup and a positive sample length\n");
+        parser.print_usage(stdout);
+        exit(1);
+    }
+}
+
+int main(int argc, const char *argv[])
+{
+    parse_args(argc, argv);
+
+    char dir_template[] = "/tmp/shanat-microbench-XXXXXX";
+    if (!mkdtemp(dir_template))
+    {
+        fprintf(stderr, "Cannot create a temporary directory\n");
+        return 1;
+    }
+    std::string dir = dir_template;
+
+    std::vector<Case> cases;
+    add_lissaj_cases(cases);
+    add_geo_cases(cases);
+    add_fps_cases(cases);
+    add_hot_file_cases(cases, dir);
+
+    CycleCounter cycles;
+    printf("%s, %s, %u CPUs; cycles %s\n", arch_name(), simd_name(), std::thread::hardware_concurrency(),
+           cycles.available() ? "from perf" : "unavailable (perf_event_open refused)");
+    printf("%-28s %7s %12s %10s %10s %10s %8s\n", "benchmark", "size", "median ns", "mad ns", "min ns", "cycles", "outliers");
+
+    std::vector<CaseResult> results;
+    for (auto &c : cases)
+    {
+        if (!filter.empty() && c.name.find(filter) == std::string::npos) continue;
+        CaseResult r = measure(c, cycles);
+        char cyc[32] = "-";
+        if (r.median_cycles >= 0) snprintf(cyc, sizeof(cyc), "%.1f", r.median_cycles);
+        printf("%-28s %7d %12.2f %10.2f %10.2f %10s %8d\n", r.name.c_str(), r.size, r.median_ns, r.mad_ns, r.min_ns, cyc,
+               r.outliers);
+        fflush(stdout);
+        results.push_back(r);
+    }
+
+    if (!out_file.empty()) write_json(results);
+
+    if (rmdir(dir.c_str()) != 0) fprintf(stderr, "Failed to remove '%s'\n", dir.c_str());
+    return 0;
+}
@@ -0,0 +1,179 @@
+#include "adaptive_res.h"
+#include "horrors.h"
+
+#include <cstdio>
+#include <math.h>
+
+// Frame time as a fraction of the frame budget
+static const float shrink_above = 0.9f;
+static const float target_load = 0.75f;
+static const float grow_below = 0.55f;
+// Scale moves in these steps, so small timing noise doesn't show up as resizing
+static const float scale_step = 1.0f / 32;
+// Smoothing factor for the exponential moving average over FPS's averaged work time
+static const float smoothing = 0.2f;
+
+static const char *blit_vert = R"(
+attribute vec2 a_pos;
+uniform vec2 uv_scale;
+varying vec2 uv;
+void main() {
+    uv = (a_pos * 0.5 + 0.5) * uv_scale;
+    gl_Position = vec4(a_pos, 0.0, 1.0);
+}
+)";
+
+static const char *blit_frag = R"(
+precision mediump float;
+uniform sampler2D tex;
+uniform vec2 uv_max;
+varying vec2 uv;
+void main() {
+    // Don't let filtering pull in texels from outside the rendered area
+    gl_FragColor = vec4(texture2D(tex, min(uv, uv_max)).rgb, 1.0);
+}
+)";
+
+static GLuint compile_blit_shader(GLenum type, const char *src)
+{
+    GLuint s = glCreateShader(type);
+    glShaderSource(s, 1, &src, nullptr);
+    glCompileShader(s);
+    GLint ok = 0;
+    glGetShaderiv(s, GL_COMPILE_STATUS, &ok);
+    if (!ok) die("glCompileShader (upscale)");
+    return s;
+}
+
+static float quantize(float scale)
+{
+    return roundf(scale / scale_step) * scale_step;
+}
+
+AdaptiveRes::AdaptiveRes(float min_scale, float max_scale, uint32_t full_w, uint32_t full_h)
+    : min_scale(min_scale)
+    , max_scale(max_scale)
+    , full_w(full_w)
+    , full_h(full_h)
+    , scale(max_scale)
+{
+    glGenTextures(1, &tex);
+    render_state.bind_texture(tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, full_w, full_h, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    render_state.bind_texture(0);
+
+    glGenFramebuffers(1, &fbo);
+    render_state.bind_framebuffer(fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) die("glCheckFramebufferStatus");
+    render_state.bind_framebuffer(default_fbo);
+
+    init_blit();
+}
+
+AdaptiveRes::~AdaptiveRes()
+{
+    render_state.delete_program(blit_prog);
+    render_state.delete_buffer(blit_vbo);
+    render_state.delete_framebuffer(fbo);
+    render_state.delete_texture(tex);
+}
+
+void AdaptiveRes::init_blit()
+{
+    GLuint vs = compile_blit_shader(GL_VERTEX_SHADER, blit_vert);
+    GLuint fs = compile_blit_shader(GL_FRAGMENT_SHADER, blit_frag);
+    blit_prog = glCreateProgram();
+    glAttachShader(blit_prog, vs);
+    glAttachShader(blit_prog, fs);
+    glBindAttribLocation(blit_prog, 0, "a_pos");
+    glLinkProgram(blit_prog);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    GLint ok = 0;
+    glGetProgramiv(blit_prog, GL_LINK_STATUS, &ok);
+    if (!ok) die("glLinkProgram (upscale)");
+    blit_uniforms.reset(blit_prog);
+    blit_uv_scale_ix = blit_uniforms.find("uv_scale");
+    blit_uv_max_ix = blit_uniforms.find("uv_max");
+
+    GLuint cur_prog = render_state.current_program();
+    render_state.use_program(blit_prog);
+    blit_uniforms.set_int(blit_uniforms.find("tex"), 0);
+    render_state.use_program(cur_prog);
+
+    static const GLfloat quad[] = {-1, -1, 1, -1, -1, 1, -1, 1, 1, -1, 1, 1};
+    glGenBuffers(1, &blit_vbo);
+    render_state.bind_array_buffer(blit_vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+}
+
+uint32_t AdaptiveRes::width() const
+{
+    uint32_t w = (uint32_t)(full_w * scale + 0.5f);
+    return w < 1 ? 1 : w;
+}
+
+uint32_t AdaptiveRes::height() const
+{
+    uint32_t h = (uint32_t)(full_h * scale + 0.5f);
+    return h < 1 ? 1 : h;
+}
+
+void AdaptiveRes::update(const FPS &fps)
+{
+    long avg_work = fps.get_avg_work_usec();
+    if (avg_work == 0) return;
+    smoothed_usec = smoothed_usec == 0 ? avg_work : smoothed_usec + smoothing * (avg_work - smoothed_usec);
+
+    // FPS averages over its whole window: let it fill with frames at the current scale first
+    frames_since_change += 1;
+    if (frames_since_change < fps.get_window_frames()) return;
+
+    float load = smoothed_usec / (float)fps.get_cycle_usec();
+    if (load < shrink_above && (load > grow_below || scale >= max_scale)) return;
+
+    // Fragment cost goes with area, i.e., with the square of the scale
+    float new_scale = quantize(scale * sqrtf(target_load / load));
+    if (new_scale < min_scale) new_scale = min_scale;
+    if (new_scale > max_scale) new_scale = max_scale;
+    if (new_scale == scale) return;
+
+    printf("Render scale %.3f -> %.3f (load %.2f)                     \n", scale, new_scale, load);
+    scale = new_scale;
+    smoothed_usec = 0;
+    frames_since_change = 0;
+}
+
+void AdaptiveRes::bind()
+{
+    render_state.bind_framebuffer(fbo);
+    render_state.viewport(0, 0, width(), height());
+}
+
+void AdaptiveRes::present()
+{
+    GLuint cur_prog = render_state.current_program();
+    bool blend = render_state.is_enabled(GL_BLEND);
+    bool depth_test = render_state.is_enabled(GL_DEPTH_TEST);
+
+    render_state.bind_framebuffer(default_fbo);
+    render_state.viewport(0, 0, full_w, full_h);
+    render_state.set_enabled(GL_BLEND, false);
+    render_state.set_enabled(GL_DEPTH_TEST, false);
+
+    render_state.use_program(blit_prog);
+    blit_uniforms.set(blit_uv_scale_ix, (float)width() / full_w, (float)height() / full_h);
+    blit_uniforms.set(blit_uv_max_ix, (width() - 0.5f) / full_w, (height() - 0.5f) / full_h);
+    render_state.bind_texture(tex);
+    render_state.vertex_attrib(0, blit_vbo, 2, GL_FLOAT);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+
+    render_state.set_enabled(GL_BLEND, blend);
+    render_state.set_enabled(GL_DEPTH_TEST, depth_test);
+    render_state.use_program(cur_prog);
+}
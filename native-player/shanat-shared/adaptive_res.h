@@ -0,0 +1,49 @@
+#ifndef ADAPTIVE_RES_H
+#define ADAPTIVE_RES_H
+
+#include "fps.h"
+#include "render_state.h"
+
+#include <GLES2/gl2.h>
+#include <stdint.h>
+
+// Renders into an offscreen target whose size follows the measured frame time,
+// then upscales the result to the default framebuffer.
+// The texture is allocated at full size once; changing scale only changes the viewport.
+class AdaptiveRes
+{
+  private:
+    const float min_scale;
+    const float max_scale;
+    const uint32_t full_w;
+    const uint32_t full_h;
+    float scale;
+    float smoothed_usec = 0;
+    int frames_since_change = 0;
+    GLuint tex = 0;
+    GLuint fbo = 0;
+    GLuint blit_prog = 0;
+    GLuint blit_vbo = 0;
+    ProgramUniforms blit_uniforms;
+    int blit_uv_scale_ix = -1;
+    int blit_uv_max_ix = -1;
+
+  private:
+    void init_blit();
+
+  public:
+    AdaptiveRes(float min_scale, float max_scale, uint32_t full_w, uint32_t full_h);
+    ~AdaptiveRes();
+    // Controller step, once per frame: shrinks when over budget, grows when well under it
+    void update(const FPS &fps);
+    // Binds the offscreen target and sets the viewport to the current scaled size
+    void bind();
+    GLuint framebuffer() const { return fbo; }
+    // Draws the scaled image to the default framebuffer; leaves the caller's program bound
+    void present();
+    float get_scale() const { return scale; }
+    uint32_t width() const;
+    uint32_t height() const;
+};
+
+#endif
@@ -0,0 +1,124 @@
+#include "fft.h"
+#include "simd.h"
+
+#include <math.h>
+
+RealFFT::RealFFT(int n)
+    : n(n)
+    , m(n / 2)
+    , bitrev(m)
+    , window(n)
+    , split_re(m)
+    , split_im(m)
+    , re(m)
+    , im(m)
+{
+    int bits = 0;
+    while ((1 << bits) < m) ++bits;
+    for (int i = 0; i < m; ++i)
+    {
+        int r = 0;
+        for (int b = 0; b < bits; ++b)
+            if (i & (1 << b)) r |= 1 << (bits - 1 - b);
+        bitrev[i] = r;
+    }
+
+    for (int i = 0; i < n; ++i) window[i] = 0.5f - 0.5f * cosf(2 * M_PI * i / n);
+
+    for (int half = 1; half < m; half *= 2)
+    {
+        for (int k = 0; k < half; ++k)
+        {
+            double a = -M_PI * k / half;
+            tw_re.push_back(cos(a));
+            tw_im.push_back(sin(a));
+        }
+    }
+
+    for (int k = 0; k < m; ++k)
+    {
+        double a = -2 * M_PI * k / n;
+        split_re[k] = cos(a);
+        split_im[k] = sin(a);
+    }
+}
+
+// In-place radix-2 decimation in time over re/im, which hold the input in bit-reversed order
+void RealFFT::transform()
+{
+    float *r = &re[0];
+    float *i = &im[0];
+    for (int half = 1; half < m; half *= 2)
+    {
+        const float *wr = &tw_re[half - 1];
+        const float *wi = &tw_im[half - 1];
+        for (int start = 0; start < m; start += 2 * half)
+        {
+            float *ar = r + start, *ai = i + start;
+            float *br = ar + half, *bi = ai + half;
+            int k = 0;
+#if defined(SHANAT_SSE)
+            for (; k + 4 <= half; k += 4)
+            {
+                __m128 xr = _mm_loadu_ps(br + k), xi = _mm_loadu_ps(bi + k);
+                __m128 cr = _mm_loadu_ps(wr + k), ci = _mm_loadu_ps(wi + k);
+                __m128 tr = _mm_sub_ps(_mm_mul_ps(xr, cr), _mm_mul_ps(xi, ci));
+                __m128 ti = _mm_add_ps(_mm_mul_ps(xr, ci), _mm_mul_ps(xi, cr));
+                __m128 yr = _mm_loadu_ps(ar + k), yi = _mm_loadu_ps(ai + k);
+                _mm_storeu_ps(br + k, _mm_sub_ps(yr, tr));
+                _mm_storeu_ps(bi + k, _mm_sub_ps(yi, ti));
+                _mm_storeu_ps(ar + k, _mm_add_ps(yr, tr));
+                _mm_storeu_ps(ai + k, _mm_add_ps(yi, ti));
+            }
+#elif defined(SHANAT_NEON)
+            for (; k + 4 <= half; k += 4)
+            {
+                float32x4_t xr = vld1q_f32(br + k), xi = vld1q_f32(bi + k);
+                float32x4_t cr = vld1q_f32(wr + k), ci = vld1q_f32(wi + k);
+                float32x4_t tr = vmlsq_f32(vmulq_f32(xr, cr), xi, ci);
+                float32x4_t ti = vmlaq_f32(vmulq_f32(xr, ci), xi, cr);
+                float32x4_t yr = vld1q_f32(ar + k), yi = vld1q_f32(ai + k);
+                vst1q_f32(br + k, vsubq_f32(yr, tr));
+                vst1q_f32(bi + k, vsubq_f32(yi, ti));
+                vst1q_f32(ar + k, vaddq_f32(yr, tr));
+                vst1q_f32(ai + k, vaddq_f32(yi, ti));
+            }
+#endif
+            // First stages, and the scalar build
+            for (; k < half; ++k)
+            {
+                float tr = br[k] * wr[k] - bi[k] * wi[k];
+                float ti = br[k] * wi[k] + bi[k] * wr[k];
+                br[k] = ar[k] - tr;
+                bi[k] = ai[k] - ti;
+                ar[k] += tr;
+                ai[k] += ti;
+            }
+        }
+    }
+}
+
+void RealFFT::magnitudes(const float *input, float *out)
+{
+    // Even samples as the real part, odd ones as the imaginary part
+    for (int j = 0; j < m; ++j)
+    {
+        re[bitrev[j]] = input[2 * j] * window[2 * j];
+        im[bitrev[j]] = input[2 * j + 1] * window[2 * j + 1];
+    }
+    transform();
+
+    // X[k] = E[k] + W^k O[k], with E and O the spectra of the even and odd samples:
+    // E = (Z[k] + conj Z[m-k]) / 2, O = (Z[k] - conj Z[m-k]) / 2i
+    // A Hann-windowed sine of amplitude A peaks at A n / 4
+    const float scale = 4.0f / n;
+    for (int k = 0; k < m; ++k)
+    {
+        int c = k == 0 ? 0 : m - k;
+        float er = 0.5f * (re[k] + re[c]), ei = 0.5f * (im[k] - im[c]);
+        float or_ = 0.5f * (im[k] + im[c]), oi = -0.5f * (re[k] - re[c]);
+        float xr = er + split_re[k] * or_ - split_im[k] * oi;
+        float xi = ei + split_re[k] * oi + split_im[k] * or_;
+        out[k] = sqrtf(xr * xr + xi * xi) * scale;
+    }
+}
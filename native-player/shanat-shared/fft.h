@@ -0,0 +1,37 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <vector>
+
+// Real-input FFT of a fixed power-of-two size, for spectrum analysis. The real signal is
+// packed into a complex FFT of half the size, then split into the real spectrum. Real and
+// imaginary parts live in separate arrays so butterflies run four at a time with SSE or
+// NEON (see simd.h); there is a scalar fallback.
+class RealFFT
+{
+  private:
+    const int n;
+    // Size of the complex FFT, n / 2
+    const int m;
+    std::vector<int> bitrev;
+    std::vector<float> window;
+    // exp(-2 pi i k / len) for k < len / 2, one run per stage, starting at len / 2 - 1
+    std::vector<float> tw_re;
+    std::vector<float> tw_im;
+    // exp(-2 pi i k / n) for the split into the real spectrum
+    std::vector<float> split_re;
+    std::vector<float> split_im;
+    std::vector<float> re;
+    std::vector<float> im;
+
+  private:
+    void transform();
+
+  public:
+    explicit RealFFT(int n);
+    int size() const { return n; }
+    // Magnitudes of bins [0, n/2) of the Hann-windowed input; a full-scale sine peaks near 1
+    void magnitudes(const float *input, float *out);
+};
+
+#endif
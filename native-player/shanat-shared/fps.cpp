@@ -1,45 +1,72 @@
 #include "fps.h"
+#include "trace.h"
 
-#include <cstdio>
-#include <math.h>
-#include <unistd.h>
+#include <cerrno>
+#include <time.h>
 
-FPS::FPS(int target_fps)
+// In catch-up mode, give up on the schedule if we fall this many frames behind
+static const int max_catch_up_frames = 3;
+
+int64_t monotonic_usec()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void sleep_until(int64_t usec)
+{
+    TRACE_SCOPE("sleep");
+    timespec ts;
+    ts.tv_sec = usec / 1000000;
+    ts.tv_nsec = (usec % 1000000) * 1000;
+    // Absolute deadline: an interrupted sleep can simply be restarted
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR)
+        ;
+}
+
+FPS::FPS(int target_fps, LatePolicy late_policy)
     : target_fps(target_fps)
     , cycle_usec(1000000 / target_fps)
     , buf_size(target_fps)
+    , late_policy(late_policy)
     , ix(0)
 {
-    elapsec_usec = new long[buf_size];
+    work_usec = new long[buf_size];
     for (int i = 0; i < buf_size; ++i)
-        elapsec_usec[i] = 0;
-    gettimeofday(&ts_init, nullptr);
-}
-
-static long calc_elapsed_usec(const timeval &start, const timeval &end)
-{
-    long seconds = end.tv_sec - start.tv_sec;
-    long microseconds = end.tv_usec - start.tv_usec;
-    long total_microseconds = seconds * 1000000 + microseconds;
-    return total_microseconds;
+        work_usec[i] = 0;
+    ts_init = monotonic_usec();
+    ts_start = ts_prev_start = 0;
+    deadline = ts_init;
 }
 
+// Returns the scheduled time of this frame, so animation advances in even steps
+// regardless of when the loop actually got around to starting the frame
 float FPS::frame_start()
 {
-    gettimeofday(&ts_start, nullptr);
-    long usec_since_init = calc_elapsed_usec(ts_init, ts_start);
+    ts_prev_start = ts_start;
+    ts_start = monotonic_usec();
+    work_done_marked = false;
+    int64_t usec_since_init = deadline - ts_init;
     double sec = usec_since_init / 1000000.0;
     return sec;
 }
 
-long FPS::get_avg_elapsed()
+void FPS::work_done(long gpu_usec)
+{
+    ts_work_done = monotonic_usec();
+    gpu_work_usec = gpu_usec;
+    work_done_marked = true;
+}
+
+long FPS::get_avg(const long *vals) const
 {
     int i = ix - 1;
     if (i < 0) i = buf_size - 1;
     long sum = 0, cnt = 0;
-    while (i != ix && elapsec_usec[i] != 0)
+    while (i != ix && vals[i] != 0)
     {
-        sum += elapsec_usec[i];
+        sum += vals[i];
         cnt += 1;
         i = i - 1;
         if (i < 0) i = buf_size - 1;
@@ -48,23 +75,57 @@ long FPS::get_avg_elapsed()
     return sum / cnt;
 }
 
+long FPS::get_avg_work_usec() const
+{
+    return get_avg(work_usec);
+}
+
+// Moves a deadline onto the closest vblank, plus a little slack so we wake up after it.
+// At 25 FPS on 50 Hz this keeps every frame start right after every other field.
+int64_t FPS::snap_to_vblank(int64_t when)
+{
+    int64_t vblank, period;
+    if (!vblank_source || !vblank_source(vblank, period) || period <= 0) return when;
+    const int64_t slack = 1000;
+    int64_t fields = (when - vblank + period / 2) / period;
+    if (when < vblank) fields = 0;
+    return vblank + fields * period + slack;
+}
+
+int64_t FPS::next_deadline(int64_t now)
+{
+    int64_t next = snap_to_vblank(deadline + cycle_usec);
+    if (next >= now) return next;
+
+    // Missed it
+    if (late_policy == LATE_CATCH_UP && now - next < max_catch_up_frames * cycle_usec) return next;
+    int64_t missed = (now - next) / cycle_usec + 1;
+    return snap_to_vblank(next + missed * cycle_usec);
+}
+
 void FPS::frame_end()
 {
-    timeval ts_end;
-    gettimeofday(&ts_end, nullptr);
-    long elapsed = calc_elapsed_usec(ts_start, ts_end);
+    record_frame();
+    if (deadline > monotonic_usec()) sleep_until(deadline);
+}
 
-    long to_store = elapsed < cycle_usec ? cycle_usec : elapsed;
-    elapsec_usec[ix] = to_store;
-    ix = (ix + 1) % buf_size;
+void FPS::record_frame()
+{
+    int64_t ts_end = monotonic_usec();
+    long elapsed = ts_end - ts_start;
 
-    int extrapolated_fps = round(1000000.0 / (double)elapsed);
-    double elapsed_msec = (double)elapsed / 1000.0;
+    long work = work_done_marked ? ts_work_done - ts_start : elapsed;
+    if (work_done_marked && gpu_work_usec > work) work = gpu_work_usec;
+    work_usec[ix] = work > 0 ? work : 1;
+    ix = (ix + 1) % buf_size;
 
-    long avg_elapsed = get_avg_elapsed();
-    double avg_fps = 1000000.0 / (double)avg_elapsed;
-    printf("FPS %5.1f / last frame %.2f msec (~%d FPS)    \r", avg_fps, elapsed_msec, extrapolated_fps);
+    // Late if we're already past the next slot of the schedule
+    bool missed = ts_end > deadline + cycle_usec;
+    if (stats)
+    {
+        uint32_t interval = ts_prev_start ? ts_start - ts_prev_start : 0;
+        stats->record(elapsed, interval, missed);
+    }
 
-    if (elapsed >= cycle_usec) return;
-    usleep(cycle_usec - elapsed);
+    deadline = next_deadline(ts_end);
 }
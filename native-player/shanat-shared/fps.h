@@ -1,27 +1,67 @@
 #ifndef FPS_H
 #define FPS_H
 
-#include <csignal>
-#include <sys/time.h>
+#include "frame_stats.h"
+
+#include <stdint.h>
+
+// What to do when a frame finishes after the next frame's deadline
+enum LatePolicy
+{
+    // Drop the missed slots and start again on the next slot of the schedule
+    LATE_SKIP,
+    // Keep the schedule and run frames back to back until we're on time again
+    LATE_CATCH_UP,
+};
+
+// Reports the monotonic time of the last vblank and the refresh period, in usec.
+// Returns false if the display can't tell (no flips yet, headless, etc.)
+typedef bool (*VBlankSource)(int64_t &last_vblank_usec, int64_t &period_usec);
 
 class FPS
 {
   private:
     const int target_fps;
-    const long cycle_usec;
+    const int64_t cycle_usec;
     const int buf_size;
-    long *elapsec_usec;
+    const LatePolicy late_policy;
+    VBlankSource vblank_source = nullptr;
+    FrameStats *stats = nullptr;
+    // Time from frame start until the frame's work was done, excluding waits for the display
+    long *work_usec;
     int ix;
-    timeval ts_init;
-    timeval ts_start;
+    int64_t ts_init;
+    int64_t ts_start;
+    int64_t ts_prev_start;
+    int64_t ts_work_done;
+    long gpu_work_usec;
+    bool work_done_marked;
+    // Scheduled start of the current frame, on CLOCK_MONOTONIC
+    int64_t deadline;
 
   private:
-    long get_avg_elapsed();
+    long get_avg(const long *vals) const;
+    int64_t next_deadline(int64_t now);
+    int64_t snap_to_vblank(int64_t when);
 
   public:
-    FPS(int target_fps);
+    FPS(int target_fps, LatePolicy late_policy = LATE_SKIP);
+    void set_vblank_source(VBlankSource source) { vblank_source = source; }
+    void set_stats(FrameStats *frame_stats) { stats = frame_stats; }
     float frame_start();
+    // Marks the frame's work as done; the GPU's share, if known, counts if it took longer
+    void work_done(long gpu_usec = 0);
+    // Records the frame and sleeps until the next one is due
     void frame_end();
+    // frame_end() without the sleep: work time, stats and the next deadline
+    void record_frame();
+    long get_cycle_usec() const { return cycle_usec; }
+    // Nominal start of the next frame, before late-frame policy and vblank snapping
+    int64_t get_next_slot() const { return deadline + cycle_usec; }
+    int get_window_frames() const { return buf_size; }
+    long get_avg_work_usec() const;
 };
 
+int64_t monotonic_usec();
+
 #endif
@@ -0,0 +1,223 @@
+#include "frame_stats.h"
+#include "fps.h"
+#include "profiler.h"
+#include "trace.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *unix_prefix = "unix:";
+
+static int bucket_of(uint32_t usec)
+{
+    if (usec < 16) return usec;
+    int msb = 31 - __builtin_clz(usec);
+    int idx = (msb - 3) * 16 + ((usec >> (msb - 4)) & 15);
+    return idx < FrameStats::n_buckets ? idx : FrameStats::n_buckets - 1;
+}
+
+// Upper bound of a bucket, which is what we report for percentiles
+static uint32_t bucket_top(int idx)
+{
+    if (idx < 16) return idx;
+    int msb = idx / 16 + 3;
+    uint32_t sub = idx % 16;
+    return ((16 + sub + 1) << (msb - 4)) - 1;
+}
+
+FrameStats::FrameStats(const std::string &target, int interval_msec)
+    : target(target)
+    , interval_msec(interval_msec)
+    , current(0)
+    , recorders(0)
+    , total_frames(0)
+    , total_missed(0)
+    , running(true)
+{
+    clear(windows[0]);
+    clear(windows[1]);
+
+    if (target.compare(0, strlen(unix_prefix), unix_prefix) == 0)
+    {
+        std::string path = target.substr(strlen(unix_prefix));
+        sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path))
+        {
+            fprintf(stderr, "Stats socket path too long: '%s'\n", path.c_str());
+            exit(-1);
+        }
+        strcpy(addr.sun_path, path.c_str());
+        unlink(path.c_str());
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0 || bind(listen_fd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, 4) != 0)
+        {
+            fprintf(stderr, "Failed to listen on stats socket '%s'\n", path.c_str());
+            exit(-1);
+        }
+    }
+
+    if (pthread_create(&thread, nullptr, publisher_fun, this) != 0)
+    {
+        fprintf(stderr, "Failed to start stats thread\n");
+        exit(-1);
+    }
+}
+
+FrameStats::~FrameStats()
+{
+    running = false;
+    pthread_join(thread, nullptr);
+    if (listen_fd >= 0)
+    {
+        close(listen_fd);
+        unlink(target.substr(strlen(unix_prefix)).c_str());
+    }
+}
+
+void FrameStats::clear(Window &w)
+{
+    for (int i = 0; i < n_buckets; ++i)
+        w.buckets[i].store(0, std::memory_order_relaxed);
+    w.frames.store(0, std::memory_order_relaxed);
+    w.missed.store(0, std::memory_order_relaxed);
+    w.max_usec.store(0, std::memory_order_relaxed);
+    w.max_stall_usec.store(0, std::memory_order_relaxed);
+}
+
+void FrameStats::record(uint32_t frame_usec, uint32_t interval_usec, bool missed_deadline)
+{
+    // Sequentially consistent with close_window(): either it sees us here, or we see its flip
+    recorders.fetch_add(1, std::memory_order_seq_cst);
+    Window &w = windows[current.load(std::memory_order_seq_cst)];
+    w.buckets[bucket_of(frame_usec)].fetch_add(1, std::memory_order_relaxed);
+    w.frames.fetch_add(1, std::memory_order_relaxed);
+    atomic_max(w.max_usec, frame_usec);
+    atomic_max(w.max_stall_usec, interval_usec);
+    total_frames.fetch_add(1, std::memory_order_relaxed);
+    if (missed_deadline)
+    {
+        w.missed.fetch_add(1, std::memory_order_relaxed);
+        total_missed.fetch_add(1, std::memory_order_relaxed);
+    }
+    recorders.fetch_sub(1, std::memory_order_release);
+}
+
+void FrameStats::close_window(int64_t window_usec)
+{
+    // Render thread moves on to the other window; once a record() that may have picked
+    // this one is done, it's ours to read and reset
+    int ix = current.load(std::memory_order_relaxed);
+    current.store(1 - ix, std::memory_order_seq_cst);
+    while (recorders.load(std::memory_order_seq_cst) > 0) sched_yield();
+    Window &w = windows[ix];
+
+    uint32_t counts[n_buckets];
+    for (int i = 0; i < n_buckets; ++i)
+        counts[i] = w.buckets[i].load(std::memory_order_relaxed);
+    uint32_t frames = w.frames.load(std::memory_order_relaxed);
+    uint32_t missed = w.missed.load(std::memory_order_relaxed);
+    uint32_t max_usec = w.max_usec.load(std::memory_order_relaxed);
+    uint32_t max_stall = w.max_stall_usec.load(std::memory_order_relaxed);
+    clear(w);
+
+    const double quantiles[] = {0.5, 0.95, 0.99};
+    uint32_t pcts[3] = {0, 0, 0};
+    uint64_t seen = 0;
+    int q = 0;
+    for (int i = 0; i < n_buckets && q < 3; ++i)
+    {
+        seen += counts[i];
+        while (q < 3 && frames > 0 && seen >= quantiles[q] * frames)
+            pcts[q++] = bucket_top(i);
+    }
+    // Percentiles can't exceed what we actually saw
+    for (int i = 0; i < 3; ++i)
+        if (pcts[i] > max_usec) pcts[i] = max_usec;
+
+    double fps = frames * 1000000.0 / window_usec;
+    printf("FPS %5.1f / p50 %.2f p95 %.2f max %.2f msec / missed %u    \r",
+           fps, pcts[0] / 1000.0, pcts[1] / 1000.0, max_usec / 1000.0, missed);
+    fflush(stdout);
+
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             "{\"timestamp_usec\":%lld,\"window_usec\":%lld,\"frames\":%u,\"fps\":%.2f,"
+             "\"frame_usec\":{\"p50\":%u,\"p95\":%u,\"p99\":%u,\"max\":%u},"
+             "\"missed_deadlines\":%u,\"longest_stall_usec\":%u,"
+             "\"total\":{\"frames\":%llu,\"missed_deadlines\":%llu},\"phases_usec\":",
+             (long long)monotonic_usec(), (long long)window_usec, frames, fps,
+             pcts[0], pcts[1], pcts[2], max_usec, missed, max_stall,
+             (unsigned long long)total_frames.load(), (unsigned long long)total_missed.load());
+    std::string fresh = buf;
+    fresh += profiler.take_json();
+    fresh += "}\n";
+    std::lock_guard<std::mutex> lock(json_mutex);
+    json.swap(fresh);
+}
+
+std::string FrameStats::latest_json()
+{
+    std::lock_guard<std::mutex> lock(json_mutex);
+    return json;
+}
+
+void FrameStats::publish_file()
+{
+    // Write next to the target and rename, so readers never see a half-written file
+    std::string tmp = target + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f) return;
+    fwrite(json.data(), 1, json.size(), f);
+    fclose(f);
+    rename(tmp.c_str(), target.c_str());
+}
+
+// Hands the latest snapshot to anyone who connects, until the timeout runs out
+void FrameStats::serve_socket(int timeout_msec)
+{
+    int64_t until = monotonic_usec() + timeout_msec * 1000LL;
+    while (running)
+    {
+        int64_t left = (until - monotonic_usec()) / 1000;
+        if (left <= 0) return;
+        pollfd pfd = {};
+        pfd.fd = listen_fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, (int)left) <= 0) continue;
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) continue;
+        if (!json.empty()) send(fd, json.data(), json.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        close(fd);
+    }
+}
+
+void *FrameStats::publisher_fun(void *arg)
+{
+    FrameStats &fs = *(FrameStats *)arg;
+    trace_thread_name("stats");
+    // Short naps so shutdown doesn't have to wait out a whole interval
+    const int nap_msec = 100;
+    int64_t window_start = monotonic_usec();
+    while (fs.running)
+    {
+        if (fs.listen_fd >= 0) fs.serve_socket(nap_msec);
+        else usleep(nap_msec * 1000);
+
+        int64_t now = monotonic_usec();
+        if (now - window_start < fs.interval_msec * 1000LL) continue;
+        fs.close_window(now - window_start);
+        window_start = now;
+        if (!fs.target.empty() && fs.listen_fd < 0) fs.publish_file();
+    }
+    return nullptr;
+}
@@ -0,0 +1,61 @@
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <atomic>
+#include <mutex>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+
+// Frame-time statistics over rolling windows.
+// The render thread records into a fixed-size histogram with atomics and never waits;
+// a publisher thread closes each window, prints a summary line and writes JSON
+// to a file (replaced atomically) or serves it on a Unix socket ("unix:/path").
+class FrameStats
+{
+  public:
+    // 16 sub-buckets per power of two: ~6% resolution, up to 16 seconds
+    static const int n_buckets = 336;
+
+  private:
+    struct Window
+    {
+        std::atomic<uint32_t> buckets[n_buckets];
+        std::atomic<uint32_t> frames;
+        std::atomic<uint32_t> missed;
+        std::atomic<uint32_t> max_usec;
+        std::atomic<uint32_t> max_stall_usec;
+    };
+
+    const std::string target;
+    const int interval_msec;
+    Window windows[2];
+    std::atomic<int> current;
+    // record() calls in progress, so closing a window can wait out one that started in it
+    std::atomic<int> recorders;
+    std::atomic<uint64_t> total_frames;
+    std::atomic<uint64_t> total_missed;
+    std::atomic<bool> running;
+    pthread_t thread = 0;
+    int listen_fd = -1;
+    // Written by the publisher thread only; the lock is for latest_json() callers
+    std::mutex json_mutex;
+    std::string json;
+
+  private:
+    static void *publisher_fun(void *arg);
+    void close_window(int64_t window_usec);
+    void publish_file();
+    void serve_socket(int timeout_msec);
+    static void clear(Window &w);
+
+  public:
+    // Empty target: only the console summary
+    FrameStats(const std::string &target, int interval_msec = 1000);
+    ~FrameStats();
+    void record(uint32_t frame_usec, uint32_t interval_usec, bool missed_deadline);
+    // Last closed window as JSON, or empty before the first one; any thread
+    std::string latest_json();
+};
+
+#endif
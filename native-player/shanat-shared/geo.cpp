@@ -1,6 +1,8 @@
 #include "geo.h"
+#include "simd.h"
 
 #include <math.h>
+#include <string.h>
 
 float Vec3::length() const
 {
@@ -14,6 +16,21 @@ void Vec3::set(float x, float y, float z)
     vals[2] = z;
 }
 
+void Vec4::set(float x, float y, float z, float w)
+{
+    vals[0] = x;
+    vals[1] = y;
+    vals[2] = z;
+    vals[3] = w;
+}
+
+Mat4 Mat4::identity()
+{
+    Mat4 mat;
+    mat.vals[0] = mat.vals[5] = mat.vals[10] = mat.vals[15] = 1;
+    return mat;
+}
+
 Vec3 normalize(const Vec3 &v)
 {
     float len = v.length();
@@ -102,3 +119,124 @@ void perspective(float fov, float aspect, float near, float far, Mat4 &mat)
     mat.vals[14] = near * far * rangeInv * 2;
     mat.vals[15] = 0;
 }
+
+// Column-major: a * v is the columns of a weighted by v's components, four lanes at a time
+
+void multiply(const Mat4 &a, const Mat4 &b, Mat4 &res)
+{
+#if defined(SHANAT_SSE)
+    __m128 c0 = _mm_load_ps(a.vals), c1 = _mm_load_ps(a.vals + 4);
+    __m128 c2 = _mm_load_ps(a.vals + 8), c3 = _mm_load_ps(a.vals + 12);
+    __m128 cols[4];
+    for (int j = 0; j < 4; ++j)
+    {
+        const float *v = b.vals + 4 * j;
+        cols[j] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, _mm_set1_ps(v[0])), _mm_mul_ps(c1, _mm_set1_ps(v[1]))),
+                             _mm_add_ps(_mm_mul_ps(c2, _mm_set1_ps(v[2])), _mm_mul_ps(c3, _mm_set1_ps(v[3]))));
+    }
+    for (int j = 0; j < 4; ++j) _mm_store_ps(res.vals + 4 * j, cols[j]);
+#elif defined(SHANAT_NEON)
+    float32x4_t c0 = vld1q_f32(a.vals), c1 = vld1q_f32(a.vals + 4);
+    float32x4_t c2 = vld1q_f32(a.vals + 8), c3 = vld1q_f32(a.vals + 12);
+    float32x4_t cols[4];
+    for (int j = 0; j < 4; ++j)
+    {
+        const float *v = b.vals + 4 * j;
+        cols[j] = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(vmulq_n_f32(c0, v[0]), c1, v[1]), c2, v[2]), c3, v[3]);
+    }
+    for (int j = 0; j < 4; ++j) vst1q_f32(res.vals + 4 * j, cols[j]);
+#else
+    float tmp[16];
+    for (int j = 0; j < 4; ++j)
+        for (int i = 0; i < 4; ++i)
+            tmp[4 * j + i] = a.vals[i] * b.vals[4 * j] + a.vals[4 + i] * b.vals[4 * j + 1] +
+                             a.vals[8 + i] * b.vals[4 * j + 2] + a.vals[12 + i] * b.vals[4 * j + 3];
+    memcpy(res.vals, tmp, sizeof(tmp));
+#endif
+}
+
+Vec4 transform(const Mat4 &mat, const Vec4 &v)
+{
+    Vec4 res;
+    transformPoints(mat, v.vals, res.vals, 1);
+    return res;
+}
+
+void transformPoints(const Mat4 &mat, const float *in, float *out, int count)
+{
+#if defined(SHANAT_SSE)
+    __m128 c0 = _mm_load_ps(mat.vals), c1 = _mm_load_ps(mat.vals + 4);
+    __m128 c2 = _mm_load_ps(mat.vals + 8), c3 = _mm_load_ps(mat.vals + 12);
+    for (int p = 0; p < count; ++p, in += 4, out += 4)
+    {
+        __m128 v = _mm_loadu_ps(in);
+        __m128 x = _mm_shuffle_ps(v, v, _MM_SHUFFLE(0, 0, 0, 0)), y = _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1));
+        __m128 z = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2)), w = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+        _mm_storeu_ps(out, _mm_add_ps(_mm_add_ps(_mm_mul_ps(c0, x), _mm_mul_ps(c1, y)),
+                                      _mm_add_ps(_mm_mul_ps(c2, z), _mm_mul_ps(c3, w))));
+    }
+#elif defined(SHANAT_NEON)
+    float32x4_t c0 = vld1q_f32(mat.vals), c1 = vld1q_f32(mat.vals + 4);
+    float32x4_t c2 = vld1q_f32(mat.vals + 8), c3 = vld1q_f32(mat.vals + 12);
+    for (int p = 0; p < count; ++p, in += 4, out += 4)
+    {
+        float32x4_t v = vld1q_f32(in);
+        float32x2_t lo = vget_low_f32(v), hi = vget_high_f32(v);
+        float32x4_t r = vmulq_lane_f32(c0, lo, 0);
+        r = vmlaq_lane_f32(r, c1, lo, 1);
+        r = vmlaq_lane_f32(r, c2, hi, 0);
+        vst1q_f32(out, vmlaq_lane_f32(r, c3, hi, 1));
+    }
+#else
+    for (int p = 0; p < count; ++p, in += 4, out += 4)
+    {
+        float x = in[0], y = in[1], z = in[2], w = in[3];
+        for (int i = 0; i < 4; ++i)
+            out[i] = mat.vals[i] * x + mat.vals[4 + i] * y + mat.vals[8 + i] * z + mat.vals[12 + i] * w;
+    }
+#endif
+}
+
+// Cofactors over shared 2x2 sub-determinants. Scalar: it runs once per frame at most, and
+// the compiler schedules this much independent arithmetic well enough.
+bool inverse(const Mat4 &mat, Mat4 &res)
+{
+    const float *m = mat.vals;
+    // 2x2 determinants of the left two columns (s) and the right two (c)
+    float s0 = m[0] * m[5] - m[4] * m[1];
+    float s1 = m[0] * m[6] - m[4] * m[2];
+    float s2 = m[0] * m[7] - m[4] * m[3];
+    float s3 = m[1] * m[6] - m[5] * m[2];
+    float s4 = m[1] * m[7] - m[5] * m[3];
+    float s5 = m[2] * m[7] - m[6] * m[3];
+    float c5 = m[10] * m[15] - m[14] * m[11];
+    float c4 = m[9] * m[15] - m[13] * m[11];
+    float c3 = m[9] * m[14] - m[13] * m[10];
+    float c2 = m[8] * m[15] - m[12] * m[11];
+    float c1 = m[8] * m[14] - m[12] * m[10];
+    float c0 = m[8] * m[13] - m[12] * m[9];
+
+    float det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+    if (det == 0 || !isfinite(det)) return false;
+    float inv = 1 / det;
+
+    float r[16];
+    r[0] = (m[5] * c5 - m[6] * c4 + m[7] * c3) * inv;
+    r[1] = (-m[1] * c5 + m[2] * c4 - m[3] * c3) * inv;
+    r[2] = (m[13] * s5 - m[14] * s4 + m[15] * s3) * inv;
+    r[3] = (-m[9] * s5 + m[10] * s4 - m[11] * s3) * inv;
+    r[4] = (-m[4] * c5 + m[6] * c2 - m[7] * c1) * inv;
+    r[5] = (m[0] * c5 - m[2] * c2 + m[3] * c1) * inv;
+    r[6] = (-m[12] * s5 + m[14] * s2 - m[15] * s1) * inv;
+    r[7] = (m[8] * s5 - m[10] * s2 + m[11] * s1) * inv;
+    r[8] = (m[4] * c4 - m[5] * c2 + m[7] * c0) * inv;
+    r[9] = (-m[0] * c4 + m[1] * c2 - m[3] * c0) * inv;
+    r[10] = (m[12] * s4 - m[13] * s2 + m[15] * s0) * inv;
+    r[11] = (-m[8] * s4 + m[9] * s2 - m[11] * s0) * inv;
+    r[12] = (-m[4] * c3 + m[5] * c1 - m[6] * c0) * inv;
+    r[13] = (m[0] * c3 - m[1] * c1 + m[2] * c0) * inv;
+    r[14] = (-m[12] * s3 + m[13] * s1 - m[14] * s0) * inv;
+    r[15] = (m[8] * s3 - m[9] * s1 + m[10] * s0) * inv;
+    memcpy(res.vals, r, sizeof(r));
+    return true;
+}
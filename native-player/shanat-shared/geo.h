@@ -8,9 +8,18 @@ struct Vec3
     float length() const;
 };
 
-struct Mat4
+// Aligned for SSE/NEON loads, like Mat4
+struct alignas(16) Vec4
+{
+    float vals[4] = {0};
+    void set(float x, float y, float z, float w);
+};
+
+// Column-major, as OpenGL takes it
+struct alignas(16) Mat4
 {
     float vals[16] = {0};
+    static Mat4 identity();
 };
 
 Vec3 normalize(const Vec3 &v);
@@ -21,4 +30,14 @@ float dot(const Vec3 &a, const Vec3 &b);
 void lookAt(const Vec3 &eye, const Vec3 &target, const Vec3 &up, Mat4 &mat);
 void perspective(float fov, float aspect, float near, float far, Mat4 &mat);
 
+// Matrix work with SSE or NEON where the target has it (see simd.h). Outputs may alias inputs.
+// res = a * b; e.g. multiply(proj, view, viewProj) to upload one matrix instead of two
+void multiply(const Mat4 &a, const Mat4 &b, Mat4 &res);
+// False, and res untouched, if mat is singular
+bool inverse(const Mat4 &mat, Mat4 &res);
+Vec4 transform(const Mat4 &mat, const Vec4 &v);
+// count points of 4 floats each, e.g. positions into clip space for culling or depth sorting;
+// in and out need no particular alignment
+void transformPoints(const Mat4 &mat, const float *in, float *out, int count);
+
 #endif
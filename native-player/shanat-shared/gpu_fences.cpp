@@ -0,0 +1,82 @@
+#include "gpu_fences.h"
+#include "fps.h"
+#include "horrors.h"
+#include "profiler.h"
+#include "trace.h"
+
+#include <cstdio>
+
+GpuFences::GpuFences()
+{
+    if (!has_extension(eglQueryString(egl_display, EGL_EXTENSIONS), "EGL_KHR_fence_sync"))
+    {
+        printf("EGL_KHR_fence_sync not available; using glFinish\n");
+        return;
+    }
+    create_sync = (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+    destroy_sync = (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+    client_wait_sync = (PFNEGLCLIENTWAITSYNCKHRPROC)eglGetProcAddress("eglClientWaitSyncKHR");
+    if (!create_sync || !destroy_sync || !client_wait_sync) create_sync = nullptr;
+}
+
+GpuFences::~GpuFences()
+{
+    // Terminating the display has already taken care of it otherwise
+    if (prev_fence != EGL_NO_SYNC_KHR && egl_display != EGL_NO_DISPLAY) destroy_sync(egl_display, prev_fence);
+}
+
+void GpuFences::frame_submitted()
+{
+    int64_t now = monotonic_usec();
+    if (!create_sync)
+    {
+        glFinish();
+        last_gpu_usec = monotonic_usec() - now;
+        profiler.add(PROF_GPU, last_gpu_usec);
+        return;
+    }
+
+    EGLSyncKHR fence = create_sync(egl_display, EGL_SYNC_FENCE_KHR, nullptr);
+    if (fence == EGL_NO_SYNC_KHR) die("eglCreateSyncKHR");
+
+    // Previous frame still pending: bound frames in flight to two
+    if (prev_fence != EGL_NO_SYNC_KHR) wait_until(-1);
+    prev_fence = fence;
+    prev_submit_usec = now;
+    last_pending_usec = now;
+}
+
+void GpuFences::wait_until(int64_t until_usec)
+{
+    if (prev_fence == EGL_NO_SYNC_KHR) return;
+    TRACE_SCOPE("gpu_wait");
+
+    // Done already: it finished some time after we last saw it pending
+    int64_t done_usec = last_pending_usec;
+    EGLint res = client_wait_sync(egl_display, prev_fence, EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, 0);
+    if (res == EGL_TIMEOUT_EXPIRED_KHR)
+    {
+        last_pending_usec = monotonic_usec();
+        EGLTimeKHR timeout = EGL_FOREVER_KHR;
+        if (until_usec >= 0)
+        {
+            int64_t left = until_usec - last_pending_usec;
+            if (left <= 0) return;
+            timeout = (EGLTimeKHR)left * 1000;
+        }
+        res = client_wait_sync(egl_display, prev_fence, 0, timeout);
+        if (res == EGL_TIMEOUT_EXPIRED_KHR)
+        {
+            last_pending_usec = monotonic_usec();
+            return;
+        }
+        // We were waiting on it, so it finished just now
+        done_usec = monotonic_usec();
+    }
+    if (res == EGL_FALSE) die("eglClientWaitSyncKHR");
+
+    destroy_sync(egl_display, prev_fence);
+    prev_fence = EGL_NO_SYNC_KHR;
+    last_gpu_usec = done_usec - prev_submit_usec;
+    profiler.add(PROF_GPU, last_gpu_usec);
+}
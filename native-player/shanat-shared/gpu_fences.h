@@ -0,0 +1,41 @@
+#ifndef GPU_FENCES_H
+#define GPU_FENCES_H
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <stdint.h>
+
+// Tracks GPU completion of frames with EGL_KHR_fence_sync instead of glFinish.
+// Each frame gets a fence after its draw calls. Submitting frame N only waits for frame N-1
+// if it's still pending, so the CPU builds the next frame while the GPU drains.
+// Without the extension, falls back to glFinish.
+class GpuFences
+{
+  private:
+    PFNEGLCREATESYNCKHRPROC create_sync = nullptr;
+    PFNEGLDESTROYSYNCKHRPROC destroy_sync = nullptr;
+    PFNEGLCLIENTWAITSYNCKHRPROC client_wait_sync = nullptr;
+    EGLSyncKHR prev_fence = EGL_NO_SYNC_KHR;
+    int64_t prev_submit_usec = 0;
+    // When the pending fence was last seen unsignalled
+    int64_t last_pending_usec = 0;
+    long last_gpu_usec = 0;
+
+  public:
+    GpuFences();
+    ~GpuFences();
+    // Call once the frame's draw calls are issued
+    void frame_submitted();
+    // Retires the pending frame if the GPU finishes before the given time. Call where the
+    // CPU would be idle anyway, so GPU time is measured when it happens, not a frame later.
+    void wait_until(int64_t until_usec);
+    // Retires the pending frame if it's already done, without waiting. Call before blocking
+    // on the display, which would otherwise count towards the GPU time.
+    void check() { wait_until(0); }
+    // Submit-to-completion time of the most recently retired frame. A fence found signalled
+    // without waiting on it counts until it was last seen pending, so time spent elsewhere,
+    // such as waiting for a page flip, never does.
+    long get_last_gpu_usec() const { return last_gpu_usec; }
+};
+
+#endif
@@ -0,0 +1,96 @@
+#include "hash.h"
+
+#include <cstring>
+
+static const uint64_t prime1 = 11400714785074694791ULL;
+static const uint64_t prime2 = 14029467366897019727ULL;
+static const uint64_t prime3 = 1609587929392839161ULL;
+static const uint64_t prime4 = 9650029242287828579ULL;
+static const uint64_t prime5 = 2870177450012600261ULL;
+
+static inline uint64_t rotl(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+// Unaligned little-endian loads; memcpy compiles to a plain load where that's allowed
+static inline uint64_t read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t lane_round(uint64_t acc, uint64_t input)
+{
+    acc += input * prime2;
+    acc = rotl(acc, 31);
+    return acc * prime1;
+}
+
+static inline uint64_t merge_round(uint64_t acc, uint64_t val)
+{
+    acc ^= lane_round(0, val);
+    return acc * prime1 + prime4;
+}
+
+uint64_t xxhash64(const void *data, size_t len, uint64_t seed)
+{
+    const uint8_t *p = (const uint8_t *)data;
+    const uint8_t *end = p + len;
+    uint64_t h;
+
+    if (len >= 32)
+    {
+        // Four independent lanes over 32-byte stripes
+        uint64_t v1 = seed + prime1 + prime2;
+        uint64_t v2 = seed + prime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - prime1;
+        for (const uint8_t *limit = end - 32; p <= limit; p += 32)
+        {
+            v1 = lane_round(v1, read64(p));
+            v2 = lane_round(v2, read64(p + 8));
+            v3 = lane_round(v3, read64(p + 16));
+            v4 = lane_round(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge_round(h, v1);
+        h = merge_round(h, v2);
+        h = merge_round(h, v3);
+        h = merge_round(h, v4);
+    }
+    else h = seed + prime5;
+
+    h += len;
+    for (; p + 8 <= end; p += 8)
+    {
+        h ^= lane_round(0, read64(p));
+        h = rotl(h, 27) * prime1 + prime4;
+    }
+    if (p + 4 <= end)
+    {
+        h ^= read32(p) * prime1;
+        h = rotl(h, 23) * prime2 + prime3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+    {
+        h ^= *p * prime5;
+        h = rotl(h, 11) * prime1;
+    }
+
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
@@ -0,0 +1,11 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// XXH64: fast non-cryptographic hash, for telling whether content changed.
+// Same results as the reference implementation on little-endian machines.
+uint64_t xxhash64(const void *data, size_t len, uint64_t seed = 0);
+
+#endif
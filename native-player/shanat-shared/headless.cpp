@@ -0,0 +1,107 @@
+#include "headless.h"
+#include "horrors.h"
+#include "profiler.h"
+
+#include <EGL/eglext.h>
+#include <GLES2/gl2ext.h>
+
+#include <cstdio>
+#include <string.h>
+
+static GLuint color_tex = 0;
+static GLuint depth_rb = 0;
+
+static void init_display()
+{
+    // Mesa's surfaceless platform needs no window system and no DRM master
+    const char *client_exts = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    if (get_platform_display && has_extension(client_exts, "EGL_MESA_platform_surfaceless"))
+        egl_display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+
+    // Otherwise whatever the default display is; we'll render via a pbuffer
+    if (egl_display == EGL_NO_DISPLAY) egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (egl_display == EGL_NO_DISPLAY) die("eglGetDisplay");
+    if (!eglInitialize(egl_display, nullptr, nullptr)) die("eglInitialize");
+    if (!eglBindAPI(EGL_OPENGL_ES_API)) die("eglBindAPI");
+}
+
+static void init_context(int width, int height)
+{
+    EGLint cfg_attribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RED_SIZE, 8,
+        EGL_GREEN_SIZE, 8,
+        EGL_BLUE_SIZE, 8,
+        EGL_ALPHA_SIZE, 8,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+        EGL_NONE};
+    EGLint num_cfg;
+    if (!eglChooseConfig(egl_display, cfg_attribs, &egl_config, 1, &num_cfg) || num_cfg < 1) die("eglChooseConfig");
+
+    EGLint ctx_attribs[] = {EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE};
+    egl_ctx = eglCreateContext(egl_display, egl_config, EGL_NO_CONTEXT, ctx_attribs);
+    if (egl_ctx == EGL_NO_CONTEXT) die("eglCreateContext");
+
+    // Prefer no surface at all; a pbuffer is only there to make the context current
+    const char *display_exts = eglQueryString(egl_display, EGL_EXTENSIONS);
+    if (!has_extension(display_exts, "EGL_KHR_surfaceless_context"))
+    {
+        EGLint pbuf_attribs[] = {EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE};
+        egl_surf = eglCreatePbufferSurface(egl_display, egl_config, pbuf_attribs);
+        if (egl_surf == EGL_NO_SURFACE) die("eglCreatePbufferSurface");
+    }
+
+    if (!eglMakeCurrent(egl_display, egl_surf, egl_surf, egl_ctx)) die("eglMakeCurrent");
+}
+
+static void init_fbo(int width, int height)
+{
+    glGenTextures(1, &color_tex);
+    glBindTexture(GL_TEXTURE_2D, color_tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    const char *gl_exts = (const char *)glGetString(GL_EXTENSIONS);
+    GLenum depth_format = has_extension(gl_exts, "GL_OES_depth24") ? GL_DEPTH_COMPONENT24_OES : GL_DEPTH_COMPONENT16;
+    glGenRenderbuffers(1, &depth_rb);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth_rb);
+    glRenderbufferStorage(GL_RENDERBUFFER, depth_format, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &default_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, default_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color_tex, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_rb);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) die("glCheckFramebufferStatus");
+    glViewport(0, 0, width, height);
+}
+
+void init_headless(int width, int height)
+{
+    init_display();
+    init_context(width, height);
+    printf("Headless renderer: %s, %dx%d\n", glGetString(GL_RENDERER), width, height);
+    init_fbo(width, height);
+    surface_width = width;
+    surface_height = height;
+}
+
+void put_on_screen_headless()
+{
+    // Nothing to scan out; just make sure the frame's commands are submitted
+    ProfScope prof(PROF_SWAP);
+    glFlush();
+}
+
+void cleanup_headless()
+{
+    if (egl_ctx == EGL_NO_CONTEXT) return;
+    if (default_fbo) glDeleteFramebuffers(1, &default_fbo);
+    if (depth_rb) glDeleteRenderbuffers(1, &depth_rb);
+    if (color_tex) glDeleteTextures(1, &color_tex);
+    default_fbo = depth_rb = color_tex = 0;
+}
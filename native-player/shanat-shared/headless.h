@@ -0,0 +1,11 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+// Offscreen backend: EGL without a window system, rendering into an FBO.
+// Used by horrors.cpp when the headless backend is selected.
+
+void init_headless(int width, int height);
+void put_on_screen_headless();
+void cleanup_headless();
+
+#endif
@@ -1,11 +1,22 @@
 #include "horrors.h"
+#include "headless.h"
+#include "profiler.h"
+#include "trace.h"
 
 #include <unistd.h>
 
+#include <cerrno>
 #include <csignal>
 #include <cstdio>
 #include <cstdlib>
 #include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+
+Backend backend = BACKEND_DRM;
+uint32_t surface_width = 0;
+uint32_t surface_height = 0;
+GLuint default_fbo = 0;
 
 int drm_fd = -1;
 drmModeRes *resources = nullptr;
@@ -16,11 +27,16 @@ drmModeModeInfo mode;
 gbm_device *gbm_dev = nullptr;
 gbm_surface *gbm_surf = nullptr;
 EGLDisplay egl_display = EGL_NO_DISPLAY;
+EGLConfig egl_config = nullptr;
 EGLContext egl_ctx = EGL_NO_CONTEXT;
 EGLSurface egl_surf = EGL_NO_SURFACE;
-gbm_bo *bo = nullptr;
-uint32_t fb_id = 0;
-uint32_t prev_fb_id = 0;
+uint32_t crtc_id = 0;
+int swap_depth = 2;
+gbm_bo *bos[max_swap_depth] = {nullptr};
+int bo_count = 0;
+bool flip_pending = false;
+int64_t last_vblank_usec = 0;
+static bool monotonic_timestamps = false;
 
 void exit_with_cleanup(int status)
 {
@@ -34,14 +50,33 @@ void die(const char *fun)
     exit_with_cleanup(1);
 }
 
-void cleanup_horrors()
+bool has_extension(const char *extensions, const char *name)
 {
-    if (bo)
+    if (!extensions) return false;
+    size_t len = strlen(name);
+    const char *p = extensions;
+    while ((p = strstr(p, name)) != nullptr)
     {
-        // Remove fb and release BO
-        if (fb_id) drmModeRmFB(drm_fd, fb_id);
-        gbm_surface_release_buffer(gbm_surf, bo);
+        if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0')) return true;
+        p += len;
     }
+    return false;
+}
+
+static void wait_for_flip();
+
+void cleanup_horrors()
+{
+    // Don't pull buffers from under a flip that is still queued
+    if (flip_pending) wait_for_flip();
+
+    // Release BOs; their FBs are removed when the surface destroys the BOs
+    for (int i = 0; i < bo_count; ++i)
+        gbm_surface_release_buffer(gbm_surf, bos[i]);
+    bo_count = 0;
+
+    // Offscreen framebuffer goes with the context
+    cleanup_headless();
 
     // Uninit EGL
     if (egl_display != EGL_NO_DISPLAY)
@@ -50,6 +85,9 @@ void cleanup_horrors()
         if (egl_ctx != EGL_NO_CONTEXT) eglDestroyContext(egl_display, egl_ctx);
         if (egl_surf != EGL_NO_SURFACE) eglDestroySurface(egl_display, egl_surf);
         eglTerminate(egl_display);
+        egl_display = EGL_NO_DISPLAY;
+        egl_ctx = EGL_NO_CONTEXT;
+        egl_surf = EGL_NO_SURFACE;
     }
 
     if (gbm_surf) gbm_surface_destroy(gbm_surf);
@@ -152,23 +190,21 @@ static void init_egl()
         EGL_DEPTH_SIZE, 24,
         EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
         EGL_NONE};
-    EGLConfig cfg;
     EGLint num_cfg;
-    if (!eglChooseConfig(egl_display, cfg_attribs, &cfg, 1, &num_cfg) || num_cfg < 1) die("eglChooseConfig");
+    if (!eglChooseConfig(egl_display, cfg_attribs, &egl_config, 1, &num_cfg) || num_cfg < 1) die("eglChooseConfig");
 
     EGLint ctx_attribs[] = {EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE};
-    egl_ctx = eglCreateContext(egl_display, cfg, EGL_NO_CONTEXT, ctx_attribs);
+    egl_ctx = eglCreateContext(egl_display, egl_config, EGL_NO_CONTEXT, ctx_attribs);
     if (egl_ctx == EGL_NO_CONTEXT) die("eglCreateContext");
 
-    egl_surf = eglCreateWindowSurface(egl_display, cfg, (EGLNativeWindowType)gbm_surf, nullptr);
+    egl_surf = eglCreateWindowSurface(egl_display, egl_config, (EGLNativeWindowType)gbm_surf, nullptr);
     if (egl_surf == EGL_NO_SURFACE) die("eglCreateWindowSurface");
 
     if (!eglMakeCurrent(egl_display, egl_surf, egl_surf, egl_ctx)) die("eglMakeCurrent");
 }
 
-static void set_crtc(drmModeModeInfo mode, uint32_t fb_id)
+static void pick_crtc()
 {
-    uint32_t crtc_id = 0;
     // Prefer encoder's crtc, else first available
     if (enc && enc->crtc_id) crtc_id = enc->crtc_id;
     else if (resources->count_crtcs > 0) crtc_id = resources->crtcs[0];
@@ -178,13 +214,203 @@ static void set_crtc(drmModeModeInfo mode, uint32_t fb_id)
         fprintf(stderr, "No available CRTC\n");
         exit_with_cleanup(1);
     }
+}
+
+static void destroy_bo_fb(gbm_bo * /*bo*/, void *data)
+{
+    uint32_t *bo_fb_id = (uint32_t *)data;
+    if (drm_fd >= 0) drmModeRmFB(drm_fd, *bo_fb_id);
+    delete bo_fb_id;
+}
+
+// Returns the FB attached to the BO, creating it the first time we see the BO.
+// The surface cycles through a handful of BOs, so FBs live as long as their BO.
+static uint32_t get_fb(gbm_bo *bo)
+{
+    uint32_t *bo_fb_id = (uint32_t *)gbm_bo_get_user_data(bo);
+    if (bo_fb_id) return *bo_fb_id;
+
+    ProfScope prof(PROF_FB);
+    uint32_t width = gbm_bo_get_width(bo);
+    uint32_t height = gbm_bo_get_height(bo);
+    uint32_t stride = gbm_bo_get_stride(bo);
+    uint32_t handle = gbm_bo_get_handle(bo).u32;
+
+    uint32_t handles[4] = {handle, 0, 0, 0};
+    uint32_t pitches[4] = {stride, 0, 0, 0};
+    uint32_t offsets[4] = {0, 0, 0, 0};
+
+    uint32_t new_fb_id = 0;
+    if (drmModeAddFB2(drm_fd, width, height, GBM_FORMAT_XRGB8888,
+                      handles, pitches, offsets, &new_fb_id, 0))
+    {
+        die("drmModeAddFB2");
+    }
+    gbm_bo_set_user_data(bo, new uint32_t(new_fb_id), destroy_bo_fb);
+    return new_fb_id;
+}
+
+// Issues a flip to the oldest queued buffer, unless one is already in flight
+static void flip_next()
+{
+    if (flip_pending || bo_count < 2) return;
+    flip_pending = true;
+    if (drmModePageFlip(drm_fd, crtc_id, get_fb(bos[1]), DRM_MODE_PAGE_FLIP_EVENT, nullptr))
+    {
+        flip_pending = false;
+        die("drmModePageFlip");
+    }
+}
+
+// Flip retired: bos[1] is on screen now, and bos[0] can go back to the surface
+static void page_flip_handler(int, unsigned int, unsigned int tv_sec, unsigned int tv_usec, void *)
+{
+    flip_pending = false;
+    if (monotonic_timestamps) last_vblank_usec = (int64_t)tv_sec * 1000000 + tv_usec;
+    gbm_surface_release_buffer(gbm_surf, bos[0]);
+    for (int i = 1; i < bo_count; ++i)
+        bos[i - 1] = bos[i];
+    bo_count -= 1;
+    flip_next();
+}
+
+// Waits for DRM events (up to timeout_ms, or forever if negative) and dispatches them
+static void handle_events(int timeout_ms)
+{
+    drmEventContext ev_ctx = {};
+    ev_ctx.version = 2;
+    ev_ctx.page_flip_handler = page_flip_handler;
+
+    pollfd pfd = {};
+    pfd.fd = drm_fd;
+    pfd.events = POLLIN;
+
+    TRACE_SCOPE("drm_events");
+    int ret = poll(&pfd, 1, timeout_ms);
+    if (ret < 0 && errno == EINTR) return;
+    if (ret < 0)
+    {
+        flip_pending = false;
+        die("poll");
+    }
+    if (ret == 0) return;
+    if (drmHandleEvent(drm_fd, &ev_ctx) != 0)
+    {
+        flip_pending = false;
+        die("drmHandleEvent");
+    }
+}
+
+// Blocks until every queued buffer has made it to the screen
+static void wait_for_flip()
+{
+    while (flip_pending)
+        handle_events(-1);
+}
+
+// Finds the primary plane that can feed our CRTC; 0 if there is none
+static uint32_t find_primary_plane()
+{
+    int crtc_ix = -1;
+    for (int i = 0; i < resources->count_crtcs; ++i)
+        if (resources->crtcs[i] == crtc_id) crtc_ix = i;
+    if (crtc_ix < 0) return 0;
+
+    // Primary planes are only listed once we ask for universal planes
+    if (drmSetClientCap(drm_fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1)) return 0;
+    drmModePlaneResPtr plane_res = drmModeGetPlaneResources(drm_fd);
+    if (!plane_res) return 0;
+
+    uint32_t plane_id = 0;
+    for (uint32_t i = 0; i < plane_res->count_planes && plane_id == 0; ++i)
+    {
+        drmModePlanePtr plane = drmModeGetPlane(drm_fd, plane_res->planes[i]);
+        if (!plane) continue;
+        if (plane->possible_crtcs & (1 << crtc_ix))
+        {
+            drmModeObjectPropertiesPtr props = drmModeObjectGetProperties(drm_fd, plane->plane_id, DRM_MODE_OBJECT_PLANE);
+            for (uint32_t j = 0; props && j < props->count_props; ++j)
+            {
+                drmModePropertyPtr prop = drmModeGetProperty(drm_fd, props->props[j]);
+                if (!prop) continue;
+                if (strcmp(prop->name, "type") == 0 && props->prop_values[j] == DRM_PLANE_TYPE_PRIMARY)
+                    plane_id = plane->plane_id;
+                drmModeFreeProperty(prop);
+            }
+            if (props) drmModeFreeObjectProperties(props);
+        }
+        drmModeFreePlane(plane);
+    }
+    drmModeFreePlaneResources(plane_res);
+    return plane_id;
+}
 
-    int ret = drmModeSetCrtc(drm_fd, crtc_id, fb_id, 0, 0, &conn->connector_id, 1, &mode);
+// Modesets with a blank, mode-sized FB, then has the primary plane upscale our smaller surface
+static void set_crtc_scaled(gbm_bo *first_bo)
+{
+    uint32_t plane_id = find_primary_plane();
+    if (!plane_id)
+    {
+        fprintf(stderr, "No primary plane to scale with\n");
+        exit_with_cleanup(1);
+    }
+
+    gbm_bo *blank = gbm_bo_create(gbm_dev, mode.hdisplay, mode.vdisplay, GBM_FORMAT_XRGB8888,
+                                  GBM_BO_USE_SCANOUT | GBM_BO_USE_LINEAR);
+    if (!blank) die("gbm_bo_create");
+    uint32_t stride;
+    void *map_data = nullptr;
+    void *pixels = gbm_bo_map(blank, 0, 0, mode.hdisplay, mode.vdisplay, GBM_BO_TRANSFER_WRITE, &stride, &map_data);
+    if (pixels)
+    {
+        memset(pixels, 0, (size_t)stride * mode.vdisplay);
+        gbm_bo_unmap(blank, map_data);
+    }
+
+    int ret = drmModeSetCrtc(drm_fd, crtc_id, get_fb(blank), 0, 0, &conn->connector_id, 1, &mode);
+    if (ret) die("drmModeSetCrtc");
+
+    // Source rectangle is 16.16 fixed point. Later page flips keep the plane's rectangles.
+    ret = drmModeSetPlane(drm_fd, plane_id, crtc_id, get_fb(first_bo), 0,
+                          0, 0, mode.hdisplay, mode.vdisplay,
+                          0, 0, surface_width << 16, surface_height << 16);
+    if (ret) die("drmModeSetPlane");
+
+    // Off screen now; destroying the BO also removes its FB
+    gbm_bo_destroy(blank);
+}
+
+// Puts the first frame on screen with a full modeset; after this, we only flip
+static void set_crtc()
+{
+    glClearColor(0, 0, 0, 1);
+    glClear(GL_COLOR_BUFFER_BIT);
+    if (!eglSwapBuffers(egl_display, egl_surf)) die("eglSwapBuffers");
+
+    bos[0] = gbm_surface_lock_front_buffer(gbm_surf);
+    if (!bos[0]) die("gbm_surface_lock_front_buffer");
+    bo_count = 1;
+
+    if (surface_width != mode.hdisplay || surface_height != mode.vdisplay)
+    {
+        set_crtc_scaled(bos[0]);
+        return;
+    }
+
+    int ret = drmModeSetCrtc(drm_fd, crtc_id, get_fb(bos[0]), 0, 0, &conn->connector_id, 1, &mode);
     if (ret) die("drmModeSetCrtc");
 }
 
-void init_horrors(const char *devicePath)
+// Rendered size for a given output size, at least a pixel
+static uint32_t scaled_size(uint32_t size, float render_scale)
 {
+    uint32_t res = (uint32_t)(size * render_scale + 0.5f);
+    return res < 1 ? 1 : res;
+}
+
+static void init_drm(const char *devicePath, int buffers, float render_scale)
+{
+    swap_depth = buffers;
     printf("Device: %s\n", devicePath);
     drm_fd = open(devicePath, O_RDWR | O_CLOEXEC);
     if (drm_fd < 0)
@@ -204,56 +430,92 @@ void init_horrors(const char *devicePath)
 
     // Pick preferred or first mode
     mode = get_first_or_preferred_mode();
+    pick_crtc();
+
+    // Flip event timestamps are only useful for pacing if they're on CLOCK_MONOTONIC
+    uint64_t cap = 0;
+    monotonic_timestamps = drmGetCap(drm_fd, DRM_CAP_TIMESTAMP_MONOTONIC, &cap) == 0 && cap != 0;
+
+    // Render smaller than the mode if asked; the display controller upscales for free
+    surface_width = render_scale < 1 ? scaled_size(mode.hdisplay, render_scale) : mode.hdisplay;
+    surface_height = render_scale < 1 ? scaled_size(mode.vdisplay, render_scale) : mode.vdisplay;
+    if (render_scale < 1) printf("Rendering at %ux%u\n", surface_width, surface_height);
 
     // GBM device and surface
     gbm_dev = gbm_create_device(drm_fd);
     if (!gbm_dev) die("gbm_create_device");
 
     gbm_surf = gbm_surface_create(gbm_dev,
-                                  mode.hdisplay,
-                                  mode.vdisplay,
+                                  surface_width,
+                                  surface_height,
                                   GBM_FORMAT_XRGB8888,
                                   GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
     if (!gbm_surf) die("gbm_surface_create");
 
     // EGL init
     init_egl();
+
+    // Modeset once with a blank frame
+    set_crtc();
 }
 
-void put_on_screen()
+void init_horrors(const HorrorsOptions &opts)
 {
-    // Swap EGL buffers
-    if (!eglSwapBuffers(egl_display, egl_surf)) die("eglSwapBuffers");
-
-    // Get new buffer
-    gbm_bo *new_bo = gbm_surface_lock_front_buffer(gbm_surf);
-    if (!new_bo) die("gbm_surface_lock_front_buffer");
+    backend = opts.backend;
+    if (backend == BACKEND_HEADLESS && opts.render_scale < 1)
+        init_headless(scaled_size(opts.width, opts.render_scale), scaled_size(opts.height, opts.render_scale));
+    else if (backend == BACKEND_HEADLESS)
+        init_headless(opts.width, opts.height);
+    else init_drm(opts.device_path.c_str(), opts.buffers, opts.render_scale);
+}
 
-    uint32_t width = gbm_bo_get_width(new_bo);
-    uint32_t height = gbm_bo_get_height(new_bo);
-    uint32_t stride = gbm_bo_get_stride(new_bo);
-    uint32_t handle = gbm_bo_get_handle(new_bo).u32;
+void put_on_screen()
+{
+    if (backend == BACKEND_HEADLESS)
+    {
+        put_on_screen_headless();
+        return;
+    }
 
-    uint32_t handles[4] = {handle, 0, 0, 0};
-    uint32_t pitches[4] = {stride, 0, 0, 0};
-    uint32_t offsets[4] = {0, 0, 0, 0};
+    // Swap EGL buffers
+    {
+        ProfScope prof(PROF_SWAP);
+        if (!eglSwapBuffers(egl_display, egl_surf)) die("eglSwapBuffers");
+    }
 
-    uint32_t new_fb_id = 0;
-    if (drmModeAddFB2(drm_fd, width, height, GBM_FORMAT_XRGB8888,
-                      handles, pitches, offsets, &new_fb_id, 0))
+    // Get new buffer and queue it behind the ones already waiting for scanout
     {
-        die("drmModeAddFB2");
+        ProfScope prof(PROF_LOCK);
+        gbm_bo *new_bo = gbm_surface_lock_front_buffer(gbm_surf);
+        if (!new_bo) die("gbm_surface_lock_front_buffer");
+        bos[bo_count++] = new_bo;
     }
 
-    // Set new framebuffer before releasing old buffer
-    set_crtc(mode, new_fb_id);
+    ProfScope prof(PROF_FLIP);
 
-    // Now safe to release old buffer and remove old FB
-    if (bo) gbm_surface_release_buffer(gbm_surf, bo);
-    if (prev_fb_id) drmModeRmFB(drm_fd, prev_fb_id);
+    // Retire flips that completed meanwhile, then flip to the next buffer on vblank
+    handle_events(0);
+    flip_next();
 
-    // Update for next iteration
-    bo = new_bo;
-    prev_fb_id = fb_id;
-    fb_id = new_fb_id;
+    // Renderer needs a free buffer for the next frame: wait for flips until we're within depth
+    while (bo_count >= swap_depth || (bo_count > 1 && !gbm_surface_has_free_buffers(gbm_surf)))
+        handle_events(-1);
+}
+
+bool get_vblank_timing(int64_t &vblank_usec, int64_t &period_usec)
+{
+    if (backend != BACKEND_DRM || last_vblank_usec == 0 || mode.clock == 0) return false;
+    vblank_usec = last_vblank_usec;
+    // Clock is in kHz; interlaced modes have a vblank per field
+    period_usec = (int64_t)mode.htotal * mode.vtotal * 1000 / mode.clock;
+    if (mode.flags & DRM_MODE_FLAG_INTERLACE) period_usec /= 2;
+    return true;
+}
+
+EGLContext create_shared_context()
+{
+    if (!has_extension(eglQueryString(egl_display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context"))
+        return EGL_NO_CONTEXT;
+    EGLint ctx_attribs[] = {EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE};
+    return eglCreateContext(egl_display, egl_config, egl_ctx, ctx_attribs);
 }
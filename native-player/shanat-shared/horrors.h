@@ -7,6 +7,31 @@
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
+#include <string>
+
+enum Backend
+{
+    BACKEND_DRM,
+    BACKEND_HEADLESS,
+};
+
+struct HorrorsOptions
+{
+    Backend backend = BACKEND_DRM;
+    std::string device_path = "/dev/dri/card0";
+    int buffers = 2;
+    // Fraction of the output resolution to render at; DRM upscales on the primary plane
+    float render_scale = 1;
+    // Size of the offscreen framebuffer; DRM uses the connector's mode instead
+    int width = 720;
+    int height = 576;
+};
+
+extern Backend backend;
+// Size of what the render loop draws into, and the framebuffer that ends up on screen
+extern uint32_t surface_width, surface_height;
+extern GLuint default_fbo;
+
 extern int drm_fd;
 extern drmModeRes *resources;
 extern drmModeConnectorPtr conn;
@@ -16,15 +41,28 @@ extern drmModeModeInfo mode;
 extern gbm_device *gbm_dev;
 extern gbm_surface *gbm_surf;
 extern EGLDisplay egl_display;
+extern EGLConfig egl_config;
 extern EGLContext egl_ctx;
 extern EGLSurface egl_surf;
-extern gbm_bo *bo;
-extern uint32_t fb_id, prev_fb_id;
+extern uint32_t crtc_id;
+// bos[0] is on screen, bos[1] is being flipped to (if flip_pending), the rest are queued
+static const int max_swap_depth = 3;
+extern int swap_depth;
+extern gbm_bo *bos[max_swap_depth];
+extern int bo_count;
+extern bool flip_pending;
+// Completion time of the last flip on CLOCK_MONOTONIC, or 0 if unknown
+extern int64_t last_vblank_usec;
 
+bool has_extension(const char *extensions, const char *name);
 void exit_with_cleanup(int status);
 void die(const char *fun);
-void init_horrors(const char *devicePath);
+void init_horrors(const HorrorsOptions &opts);
 void put_on_screen();
+bool get_vblank_timing(int64_t &vblank_usec, int64_t &period_usec);
+// Context sharing objects with egl_ctx, for use without a surface on another thread.
+// EGL_NO_CONTEXT if the display can't make contexts current without a surface.
+EGLContext create_shared_context();
 void cleanup_horrors();
 
 #endif
@@ -0,0 +1,58 @@
+#include "horrors_args.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+void add_horrors_arguments(ArgumentParser &parser, Backend default_backend)
+{
+    bool headless = default_backend == BACKEND_HEADLESS;
+    parser.add_argument("dev", "--dev", "", "Device path (default: /dev/dri/card0)", STORE);
+    parser.add_argument("buffers", "--buffers", "", "Swap chain depth: 2 or 3 (default: 2)", STORE, "2");
+    parser.add_argument("backend", "--backend", "",
+                        headless ? "Rendering backend: drm or headless (default: headless)"
+                                 : "Rendering backend: drm or headless (default: drm)",
+                        STORE, headless ? "headless" : "drm");
+    parser.add_argument("render-scale", "--render-scale", "", "Render at this fraction of output size, e.g. 0.5 (default: 1)", STORE, "1");
+    parser.add_argument("size", "--size", "", "Offscreen size for headless backend (default: 720x576)", STORE, "720x576");
+}
+
+bool read_horrors_arguments(ArgumentParser &parser, HorrorsOptions &opts)
+{
+    bool ok = true;
+
+    if (parser.get("dev").is_set) opts.device_path = parser.get("dev").value;
+
+    auto buffers_val = parser.get("buffers").value;
+    opts.buffers = atoi(buffers_val.c_str());
+    if (opts.buffers < 2 || opts.buffers > max_swap_depth)
+    {
+        fprintf(stderr, "Buffers value must be 2 or 3; got '%s'\n", buffers_val.c_str());
+        ok = false;
+    }
+
+    auto backend_val = parser.get("backend").value;
+    if (backend_val == "drm") opts.backend = BACKEND_DRM;
+    else if (backend_val == "headless") opts.backend = BACKEND_HEADLESS;
+    else
+    {
+        fprintf(stderr, "Backend must be 'drm' or 'headless'; got '%s'\n", backend_val.c_str());
+        ok = false;
+    }
+
+    auto scale_val = parser.get("render-scale").value;
+    opts.render_scale = atof(scale_val.c_str());
+    if (opts.render_scale <= 0 || opts.render_scale > 1)
+    {
+        fprintf(stderr, "Render scale must be in (0, 1]; got '%s'\n", scale_val.c_str());
+        ok = false;
+    }
+
+    auto size_val = parser.get("size").value;
+    if (sscanf(size_val.c_str(), "%dx%d", &opts.width, &opts.height) != 2 || opts.width <= 0 || opts.height <= 0)
+    {
+        fprintf(stderr, "Size must be WIDTHxHEIGHT; got '%s'\n", size_val.c_str());
+        ok = false;
+    }
+
+    return ok;
+}
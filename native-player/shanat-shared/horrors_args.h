@@ -0,0 +1,11 @@
+#ifndef HORRORS_ARGS_H
+#define HORRORS_ARGS_H
+
+#include "arg_parse.h"
+#include "horrors.h"
+
+// Display arguments shared by all binaries: --dev, --buffers, --backend, --size, --render-scale
+void add_horrors_arguments(ArgumentParser &parser, Backend default_backend = BACKEND_DRM);
+bool read_horrors_arguments(ArgumentParser &parser, HorrorsOptions &opts);
+
+#endif
@@ -0,0 +1,22 @@
+#include "json.h"
+
+#include <cstdio>
+
+std::string json_string(const std::string &str)
+{
+    std::string out = "\"";
+    for (char c : str)
+    {
+        if (c == '"' || c == '\\') out += '\\', out += c;
+        else if (c == '\n') out += "\\n";
+        else if (c == '\t') out += "\\t";
+        else if ((unsigned char)c < 0x20)
+        {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        }
+        else out += c;
+    }
+    return out + "\"";
+}
@@ -0,0 +1,9 @@
+#ifndef JSON_H
+#define JSON_H
+
+#include <string>
+
+// Quoted JSON string literal for arbitrary text, e.g. a compiler log
+std::string json_string(const std::string &str);
+
+#endif
@@ -0,0 +1,266 @@
+#include "offline.h"
+#include "fps.h"
+#include "horrors.h"
+#include "render_state.h"
+#include "trace.h"
+
+#include <GLES2/gl2ext.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+void add_offline_arguments(ArgumentParser &parser)
+{
+    parser.add_argument("offline", "--offline", "", "Render this many frames as fast as possible instead of running live", STORE);
+    parser.add_argument("dt", "--dt", "", "Offline timestep in seconds (default: 0.04)", STORE, "0.04");
+    parser.add_argument("out", "--out", "", "Offline output: .y4m video or raw RGB24 frames", STORE);
+}
+
+bool read_offline_arguments(ArgumentParser &parser, OfflineOptions &opts)
+{
+    bool ok = true;
+
+    auto offline_val = parser.get("offline");
+    if (offline_val.is_set)
+    {
+        opts.frames = atoi(offline_val.value.c_str());
+        if (opts.frames <= 0)
+        {
+            fprintf(stderr, "Offline frame count must be positive integer; got '%s'\n", offline_val.value.c_str());
+            ok = false;
+        }
+    }
+
+    auto dt_val = parser.get("dt").value;
+    opts.dt = atof(dt_val.c_str());
+    if (opts.dt <= 0)
+    {
+        fprintf(stderr, "Timestep must be positive; got '%s'\n", dt_val.c_str());
+        ok = false;
+    }
+
+    if (parser.get("out").is_set) opts.out = parser.get("out").value;
+    if (!opts.out.empty() && opts.frames == 0)
+    {
+        fprintf(stderr, "--out needs --offline\n");
+        ok = false;
+    }
+
+    return ok;
+}
+
+OfflineRenderer::OfflineRenderer(const OfflineOptions &opts, uint32_t width, uint32_t height)
+    : opts(opts)
+    , width(width)
+    , height(height)
+{
+    const char *gl_exts = (const char *)glGetString(GL_EXTENSIONS);
+    GLenum depth_format = has_extension(gl_exts, "GL_OES_depth24") ? GL_DEPTH_COMPONENT24_OES : GL_DEPTH_COMPONENT16;
+    glGenTextures(ring_size, texs);
+    glGenRenderbuffers(ring_size, depth_rbs);
+    glGenFramebuffers(ring_size, fbos);
+    for (int i = 0; i < ring_size; ++i)
+    {
+        render_state.bind_texture(texs[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glBindRenderbuffer(GL_RENDERBUFFER, depth_rbs[i]);
+        glRenderbufferStorage(GL_RENDERBUFFER, depth_format, width, height);
+        render_state.bind_framebuffer(fbos[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texs[i], 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_rbs[i]);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) die("glCheckFramebufferStatus (offline)");
+    }
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    render_state.bind_texture(0);
+
+    if (!opts.out.empty())
+    {
+        file = fopen(opts.out.c_str(), "wb");
+        if (!file)
+        {
+            fprintf(stderr, "Cannot open '%s' for writing\n", opts.out.c_str());
+            exit_with_cleanup(1);
+        }
+        size_t n = opts.out.size();
+        y4m = n >= 4 && opts.out.compare(n - 4, 4, ".y4m") == 0;
+        if (y4m)
+        {
+            // Full-range BT.601, which is what C420jpeg means to ffmpeg
+            fprintf(file, "YUV4MPEG2 W%u H%u F%d:1000 Ip A1:1 C420jpeg\n", width, height, (int)lroundf(1000 / opts.dt));
+        }
+        if (pthread_create(&thread, nullptr, writer_fun, this) != 0)
+        {
+            fprintf(stderr, "Failed to start frame writer thread\n");
+            exit_with_cleanup(1);
+        }
+    }
+
+    printf("Offline: %d frames at %ux%u, dt %.4f s%s%s\n", opts.frames, width, height, opts.dt,
+           file ? " -> " : "", opts.out.c_str());
+    start_usec = monotonic_usec();
+}
+
+OfflineRenderer::~OfflineRenderer()
+{
+    if (thread != 0) finish();
+    for (int i = 0; i < ring_size; ++i)
+    {
+        render_state.delete_framebuffer(fbos[i]);
+        render_state.delete_texture(texs[i]);
+    }
+    glDeleteRenderbuffers(ring_size, depth_rbs);
+}
+
+bool OfflineRenderer::next_frame(float &time)
+{
+    if (frame >= opts.frames) return false;
+    time = frame * opts.dt;
+    return true;
+}
+
+void OfflineRenderer::frame_done()
+{
+    glFlush();
+    // Oldest frame in the ring has had ring_size - 1 frames' time to finish on the GPU
+    if (file && frame >= ring_size - 1) read_back(frame - (ring_size - 1));
+    ++frame;
+}
+
+void OfflineRenderer::read_back(int frame_ix)
+{
+    TRACE_SCOPE("readback");
+    std::vector<uint8_t> rgba;
+    {
+        // Writer is behind: don't pile up frames in memory
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [this] { return (int)queue.size() < max_queued; });
+        if (!spare.empty())
+        {
+            rgba.swap(spare.back());
+            spare.pop_back();
+        }
+    }
+    rgba.resize(width * height * 4);
+
+    int64_t t0 = monotonic_usec();
+    render_state.bind_framebuffer(fbos[frame_ix % ring_size]);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, &rgba[0]);
+    readback_usec += monotonic_usec() - t0;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(rgba));
+    }
+    cond.notify_all();
+}
+
+void OfflineRenderer::finish()
+{
+    if (file)
+    {
+        int first = frame - (ring_size - 1);
+        for (int i = first < 0 ? 0 : first; i < frame; ++i) read_back(i);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            writing = false;
+        }
+        cond.notify_all();
+        pthread_join(thread, nullptr);
+        thread = 0;
+        fclose(file);
+        file = nullptr;
+    }
+    else glFinish();
+
+    double secs = (monotonic_usec() - start_usec) / 1e6;
+    printf("Offline: %d frames in %.2f s, %.1f fps", frame, secs, secs > 0 ? frame / secs : 0);
+    if (opts.out.empty()) printf("\n");
+    else printf(", readback avg %.2f msec\n", frame ? readback_usec / 1000.0 / frame : 0);
+}
+
+void *OfflineRenderer::writer_fun(void *arg)
+{
+    OfflineRenderer &off = *(OfflineRenderer *)arg;
+    trace_thread_name("frame_writer");
+
+    std::vector<uint8_t> rgba, out;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(off.mutex);
+            off.cond.wait(lock, [&off] { return !off.queue.empty() || !off.writing; });
+            if (off.queue.empty()) break;
+            rgba.swap(off.queue.front());
+            off.queue.pop_front();
+        }
+        off.cond.notify_all();
+
+        off.write_frame(rgba, out);
+
+        std::lock_guard<std::mutex> lock(off.mutex);
+        off.spare.push_back(std::vector<uint8_t>());
+        off.spare.back().swap(rgba);
+    }
+    return nullptr;
+}
+
+void OfflineRenderer::write_frame(const std::vector<uint8_t> &rgba, std::vector<uint8_t> &out)
+{
+    TRACE_SCOPE("write_frame");
+    const uint32_t w = width, h = height;
+    const size_t stride = w * 4;
+    // GL's rows go bottom to top
+    auto row = [&](uint32_t y) { return &rgba[(h - 1 - y) * stride]; };
+
+    if (!y4m)
+    {
+        out.resize(w * h * 3);
+        uint8_t *dst = &out[0];
+        for (uint32_t y = 0; y < h; ++y)
+        {
+            const uint8_t *src = row(y);
+            for (uint32_t x = 0; x < w; ++x, src += 4, dst += 3)
+            {
+                dst[0] = src[0];
+                dst[1] = src[1];
+                dst[2] = src[2];
+            }
+        }
+        fwrite(&out[0], 1, out.size(), file);
+        return;
+    }
+
+    // Full-range BT.601 in 16.16 fixed point; chroma from the average of each 2x2 block
+    const uint32_t cw = (w + 1) / 2, ch = (h + 1) / 2;
+    out.resize(w * h + 2 * cw * ch);
+    uint8_t *py = &out[0];
+    uint8_t *pu = py + w * h;
+    uint8_t *pv = pu + cw * ch;
+    for (uint32_t y = 0; y < h; ++y)
+    {
+        const uint8_t *src = row(y);
+        for (uint32_t x = 0; x < w; ++x, src += 4)
+            *py++ = (19595 * src[0] + 38470 * src[1] + 7471 * src[2] + 32768) >> 16;
+    }
+    for (uint32_t cy = 0; cy < ch; ++cy)
+    {
+        const uint8_t *r0 = row(cy * 2);
+        const uint8_t *r1 = row(cy * 2 + 1 < h ? cy * 2 + 1 : cy * 2);
+        for (uint32_t cx = 0; cx < cw; ++cx)
+        {
+            uint32_t x0 = cx * 8, x1 = cx * 2 + 1 < w ? x0 + 4 : x0;
+            int r = r0[x0] + r0[x1] + r1[x0] + r1[x1];
+            int g = r0[x0 + 1] + r0[x1 + 1] + r1[x0 + 1] + r1[x1 + 1];
+            int b = r0[x0 + 2] + r0[x1 + 2] + r1[x0 + 2] + r1[x1 + 2];
+            // Sums are 4x the averages: fold the /4 into the shift
+            int u = (-11059 * r - 21709 * g + 32768 * b + (128 << 18) + (1 << 17)) >> 18;
+            int v = (32768 * r - 27439 * g - 5329 * b + (128 << 18) + (1 << 17)) >> 18;
+            *pu++ = u < 0 ? 0 : u > 255 ? 255 : u;
+            *pv++ = v < 0 ? 0 : v > 255 ? 255 : v;
+        }
+    }
+    fwrite("FRAME\n", 1, 6, file);
+    fwrite(&out[0], 1, out.size(), file);
+}
@@ -0,0 +1,77 @@
+#ifndef OFFLINE_H
+#define OFFLINE_H
+
+#include "arg_parse.h"
+
+#include <GLES2/gl2.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct OfflineOptions
+{
+    // Frames to render; 0 means run live, paced by the display
+    int frames = 0;
+    // Seconds of sketch time per frame
+    float dt = 0.04f;
+    // .y4m gets 4:2:0 YUV4MPEG2, anything else raw top-down RGB24; empty renders without readback
+    std::string out;
+};
+
+// Offline arguments shared by all binaries: --offline, --dt, --out
+void add_offline_arguments(ArgumentParser &parser);
+bool read_offline_arguments(ArgumentParser &parser, OfflineOptions &opts);
+
+// Renders a fixed number of frames on a fixed timestep as fast as the GPU goes, into a small
+// ring of FBOs. Each frame is read back only once the ring comes around to it, so glReadPixels
+// (synchronous in ES2) waits on a frame the GPU finished long ago rather than the one just
+// submitted. A writer thread converts and writes frames, so disk I/O overlaps rendering.
+class OfflineRenderer
+{
+  private:
+    static const int ring_size = 3;
+    static const int max_queued = 4;
+
+    const OfflineOptions opts;
+    const uint32_t width;
+    const uint32_t height;
+    GLuint fbos[ring_size];
+    GLuint texs[ring_size];
+    GLuint depth_rbs[ring_size];
+    int frame = 0;
+    int64_t start_usec = 0;
+    int64_t readback_usec = 0;
+
+    FILE *file = nullptr;
+    bool y4m = false;
+    pthread_t thread = 0;
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool writing = true;
+    std::deque<std::vector<uint8_t>> queue;
+    std::vector<std::vector<uint8_t>> spare;
+
+  private:
+    static void *writer_fun(void *arg);
+    void read_back(int frame_ix);
+    void write_frame(const std::vector<uint8_t> &rgba, std::vector<uint8_t> &out);
+
+  public:
+    OfflineRenderer(const OfflineOptions &opts, uint32_t width, uint32_t height);
+    // Needs the context still current
+    ~OfflineRenderer();
+    // Sketch time of the next frame; false once all frames are rendered
+    bool next_frame(float &time);
+    // Where the current frame must be drawn
+    GLuint framebuffer() const { return fbos[frame % ring_size]; }
+    // Call after the current frame's draw calls
+    void frame_done();
+    // Reads back what's still in the ring, waits for the writer, prints throughput
+    void finish();
+};
+
+#endif
@@ -0,0 +1,71 @@
+#include "profiler.h"
+#include "fps.h"
+#include "trace.h"
+
+#include <cstdio>
+
+Profiler profiler;
+
+static const char *phase_names[PROF_PHASE_COUNT] = {
+    "uniforms",
+    "draw",
+    "gpu",
+    "swap",
+    "lock",
+    "fb",
+    "flip",
+};
+
+void atomic_max(std::atomic<uint32_t> &target, uint32_t val)
+{
+    uint32_t cur = target.load(std::memory_order_relaxed);
+    while (val > cur && !target.compare_exchange_weak(cur, val, std::memory_order_relaxed))
+        ;
+}
+
+Profiler::Profiler()
+{
+    for (int i = 0; i < PROF_PHASE_COUNT; ++i)
+    {
+        sum_usec[i] = 0;
+        count[i] = 0;
+        max_usec[i] = 0;
+    }
+}
+
+void Profiler::add(ProfPhase phase, int64_t usec)
+{
+    sum_usec[phase].fetch_add(usec, std::memory_order_relaxed);
+    count[phase].fetch_add(1, std::memory_order_relaxed);
+    atomic_max(max_usec[phase], usec);
+}
+
+std::string Profiler::take_json()
+{
+    std::string res = "{";
+    for (int i = 0; i < PROF_PHASE_COUNT; ++i)
+    {
+        uint64_t sum = sum_usec[i].exchange(0, std::memory_order_relaxed);
+        uint32_t cnt = count[i].exchange(0, std::memory_order_relaxed);
+        uint32_t max = max_usec[i].exchange(0, std::memory_order_relaxed);
+        char buf[96];
+        snprintf(buf, sizeof(buf), "%s\"%s\":{\"avg\":%llu,\"max\":%u}",
+                 i == 0 ? "" : ",", phase_names[i], (unsigned long long)(cnt ? sum / cnt : 0), max);
+        res += buf;
+    }
+    res += "}";
+    return res;
+}
+
+ProfScope::ProfScope(ProfPhase phase)
+    : phase(phase)
+    , start(monotonic_usec())
+{
+}
+
+ProfScope::~ProfScope()
+{
+    int64_t dur = monotonic_usec() - start;
+    profiler.add(phase, dur);
+    trace_record(phase_names[phase], start, dur);
+}
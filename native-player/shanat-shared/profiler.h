@@ -0,0 +1,52 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string>
+
+enum ProfPhase
+{
+    PROF_UNIFORMS,
+    PROF_DRAW,
+    PROF_GPU,
+    PROF_SWAP,
+    PROF_LOCK,
+    PROF_FB,
+    PROF_FLIP,
+    PROF_PHASE_COUNT,
+};
+
+// Per-phase CPU/GPU time accumulated by the render thread with relaxed atomics,
+// and collected periodically by whoever publishes stats
+class Profiler
+{
+  private:
+    std::atomic<uint64_t> sum_usec[PROF_PHASE_COUNT];
+    std::atomic<uint32_t> count[PROF_PHASE_COUNT];
+    std::atomic<uint32_t> max_usec[PROF_PHASE_COUNT];
+
+  public:
+    Profiler();
+    void add(ProfPhase phase, int64_t usec);
+    // Per-phase average and max since the last call, as a JSON object; resets the counters
+    std::string take_json();
+};
+
+extern Profiler profiler;
+
+// Times the enclosing scope into one phase; also shows up as a span if tracing is on
+class ProfScope
+{
+  private:
+    const ProfPhase phase;
+    const int64_t start;
+
+  public:
+    ProfScope(ProfPhase phase);
+    ~ProfScope();
+};
+
+void atomic_max(std::atomic<uint32_t> &target, uint32_t val);
+
+#endif
@@ -0,0 +1,224 @@
+#include "program_cache.h"
+#include "horrors.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+static const char entry_magic[4] = {'S', 'H', 'P', 'B'};
+static const uint32_t entry_version = 1;
+
+struct EntryHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;
+    uint32_t length;
+};
+
+// 64-bit FNV-1a; fed the terminating zero too, so "ab"+"c" differs from "a"+"bc"
+static uint64_t fnv1a(uint64_t h, const char *str)
+{
+    const unsigned char *p = (const unsigned char *)str;
+    do
+    {
+        h ^= *p;
+        h *= 0x100000001b3ULL;
+    } while (*p++ != 0);
+    return h;
+}
+
+static bool make_dirs(const std::string &path)
+{
+    for (size_t i = 1; i <= path.size(); ++i)
+    {
+        if (i != path.size() && path[i] != '/') continue;
+        std::string part = path.substr(0, i);
+        if (mkdir(part.c_str(), 0755) != 0 && errno != EEXIST) return false;
+    }
+    return true;
+}
+
+std::string ProgramCache::default_dir()
+{
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    if (xdg && xdg[0]) return std::string(xdg) + "/shanat";
+    const char *home = getenv("HOME");
+    if (home && home[0]) return std::string(home) + "/.cache/shanat";
+    return "";
+}
+
+ProgramCache::ProgramCache(const std::string &dir, size_t max_bytes)
+    : dir(dir)
+    , max_bytes(max_bytes)
+{
+    if (dir.empty()) return;
+
+    const char *gl_exts = (const char *)glGetString(GL_EXTENSIONS);
+    GLint num_formats = 0;
+    if (has_extension(gl_exts, "GL_OES_get_program_binary")) glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &num_formats);
+    if (num_formats < 1)
+    {
+        printf("Program binaries not supported; not caching programs\n");
+        return;
+    }
+    if (!make_dirs(dir))
+    {
+        fprintf(stderr, "Cannot create program cache directory '%s'\n", dir.c_str());
+        return;
+    }
+
+    // Anything that changes what the compiler emits goes here
+    driver.assign((const char *)glGetString(GL_VENDOR));
+    driver.append("\n");
+    driver.append((const char *)glGetString(GL_RENDERER));
+    driver.append("\n");
+    driver.append((const char *)glGetString(GL_VERSION));
+
+    get_program_binary = (PFNGLGETPROGRAMBINARYOESPROC)eglGetProcAddress("glGetProgramBinaryOES");
+    program_binary = (PFNGLPROGRAMBINARYOESPROC)eglGetProcAddress("glProgramBinaryOES");
+    if (!get_program_binary) program_binary = nullptr;
+}
+
+uint64_t ProgramCache::key(const char *vert_src, const char *frag_src) const
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    h = fnv1a(h, driver.c_str());
+    h = fnv1a(h, vert_src);
+    return fnv1a(h, frag_src);
+}
+
+std::string ProgramCache::entry_path(uint64_t key) const
+{
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)key);
+    return dir + name;
+}
+
+GLuint ProgramCache::load(const char *vert_src, const char *frag_src)
+{
+    if (!is_enabled()) return 0;
+    TRACE_SCOPE("cache_load");
+
+    uint64_t k = key(vert_src, frag_src);
+    std::string path = entry_path(k);
+    FILE *f = fopen(path.c_str(), "rb");
+    if (!f) return 0;
+
+    EntryHeader hdr;
+    std::vector<char> data;
+    bool ok = fread(&hdr, sizeof(hdr), 1, f) == 1 &&
+              memcmp(hdr.magic, entry_magic, sizeof(entry_magic)) == 0 &&
+              hdr.version == entry_version && hdr.key == k && hdr.length > 0;
+    if (ok)
+    {
+        data.resize(hdr.length);
+        ok = fread(&data[0], 1, hdr.length, f) == hdr.length;
+    }
+    fclose(f);
+
+    GLuint prog = 0;
+    if (ok)
+    {
+        prog = glCreateProgram();
+        program_binary(prog, hdr.format, &data[0], hdr.length);
+        GLint linked = 0;
+        glGetProgramiv(prog, GL_LINK_STATUS, &linked);
+        if (!linked)
+        {
+            glDeleteProgram(prog);
+            prog = 0;
+        }
+    }
+
+    // Driver rejected it or file is damaged: drop it, caller compiles and stores afresh
+    if (prog == 0)
+    {
+        unlink(path.c_str());
+        return 0;
+    }
+
+    // Mark as recently used for eviction
+    utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+    return prog;
+}
+
+void ProgramCache::store(GLuint prog, const char *vert_src, const char *frag_src)
+{
+    if (!is_enabled()) return;
+    TRACE_SCOPE("cache_store");
+
+    GLint len = 0;
+    glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH_OES, &len);
+    if (len <= 0) return;
+
+    EntryHeader hdr;
+    memcpy(hdr.magic, entry_magic, sizeof(entry_magic));
+    hdr.version = entry_version;
+    hdr.key = key(vert_src, frag_src);
+    std::vector<char> data(len);
+    GLsizei written = 0;
+    get_program_binary(prog, len, &written, &hdr.format, &data[0]);
+    if (written <= 0) return;
+    hdr.length = written;
+
+    // Write next to the entry and rename, so a crash never leaves a truncated entry
+    std::string path = entry_path(hdr.key);
+    std::string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f) return;
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 && fwrite(&data[0], 1, written, f) == (size_t)written;
+    if (fclose(f) != 0) ok = false;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        unlink(tmp.c_str());
+        return;
+    }
+
+    evict();
+}
+
+void ProgramCache::evict()
+{
+    struct Entry
+    {
+        std::string path;
+        size_t size;
+        int64_t used_nsec;
+    };
+    std::vector<Entry> entries;
+    size_t total = 0;
+
+    DIR *d = opendir(dir.c_str());
+    if (!d) return;
+    while (struct dirent *de = readdir(d))
+    {
+        size_t n = strlen(de->d_name);
+        if (n < 4 || strcmp(de->d_name + n - 4, ".bin") != 0) continue;
+        Entry e;
+        e.path = dir + "/" + de->d_name;
+        struct stat st;
+        if (stat(e.path.c_str(), &st) != 0) continue;
+        e.size = st.st_size;
+        e.used_nsec = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        total += e.size;
+        entries.push_back(e);
+    }
+    closedir(d);
+    if (total <= max_bytes) return;
+
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) { return a.used_nsec < b.used_nsec; });
+    for (size_t i = 0; i < entries.size() && total > max_bytes; ++i)
+    {
+        if (unlink(entries[i].path.c_str()) == 0) total -= entries[i].size;
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Persistent store of linked program binaries (GL_OES_get_program_binary), so shaders we
+// have seen before skip the compiler. Entries are keyed by a hash of the vertex and fragment
+// source plus the renderer and driver version strings; after a driver upgrade the old
+// entries simply stop matching and age out. Eviction is least recently used by file mtime,
+// bounded by total size. Not thread-safe: use from one thread, with a context current.
+class ProgramCache
+{
+  private:
+    const std::string dir;
+    const size_t max_bytes;
+    std::string driver;
+    PFNGLGETPROGRAMBINARYOESPROC get_program_binary = nullptr;
+    PFNGLPROGRAMBINARYOESPROC program_binary = nullptr;
+
+  private:
+    uint64_t key(const char *vert_src, const char *frag_src) const;
+    std::string entry_path(uint64_t key) const;
+    void evict();
+
+  public:
+    static const size_t default_max_bytes = 32 * 1024 * 1024;
+    // Default location: $XDG_CACHE_HOME/shanat, or ~/.cache/shanat
+    static std::string default_dir();
+
+    // Empty dir disables the cache. Needs a current context.
+    ProgramCache(const std::string &dir, size_t max_bytes = default_max_bytes);
+    bool is_enabled() const { return program_binary != nullptr; }
+    // Linked program restored from the cache, or 0 on a miss
+    GLuint load(const char *vert_src, const char *frag_src);
+    // Saves a freshly linked program
+    void store(GLuint prog, const char *vert_src, const char *frag_src);
+};
+
+#endif
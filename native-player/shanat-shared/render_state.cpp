@@ -0,0 +1,231 @@
+#include "render_state.h"
+
+#include <cstring>
+
+RenderState render_state;
+
+void RenderState::invalidate()
+{
+    program = array_buffer = framebuffer = unknown;
+    for (int i = 0; i < max_texture_units; ++i) textures[i] = unknown;
+    active_unit = unknown;
+    vp[0] = vp[1] = vp[2] = vp[3] = -1;
+    blend = depth_test = -1;
+    // Nothing here disables attributes, so assuming "disabled" only costs one redundant enable
+    for (int i = 0; i < max_attribs; ++i)
+    {
+        attribs[i].enabled = false;
+        attribs[i].buffer = unknown;
+    }
+}
+
+void RenderState::use_program(GLuint prog)
+{
+    if (prog == program || prog == unknown) return;
+    glUseProgram(prog);
+    program = prog;
+}
+
+void RenderState::bind_array_buffer(GLuint buffer)
+{
+    if (buffer == array_buffer) return;
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    array_buffer = buffer;
+}
+
+void RenderState::bind_framebuffer(GLuint fbo)
+{
+    if (fbo == framebuffer) return;
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    framebuffer = fbo;
+}
+
+void RenderState::bind_texture(GLuint tex, int unit)
+{
+    if (tex == textures[unit]) return;
+    if (active_unit != (GLenum)(GL_TEXTURE0 + unit))
+    {
+        active_unit = GL_TEXTURE0 + unit;
+        glActiveTexture(active_unit);
+    }
+    glBindTexture(GL_TEXTURE_2D, tex);
+    textures[unit] = tex;
+}
+
+void RenderState::viewport(GLint x, GLint y, GLsizei w, GLsizei h)
+{
+    if (vp[0] == x && vp[1] == y && vp[2] == w && vp[3] == h) return;
+    glViewport(x, y, w, h);
+    vp[0] = x;
+    vp[1] = y;
+    vp[2] = w;
+    vp[3] = h;
+}
+
+signed char *RenderState::cap_slot(GLenum cap)
+{
+    if (cap == GL_BLEND) return &blend;
+    if (cap == GL_DEPTH_TEST) return &depth_test;
+    return nullptr;
+}
+
+void RenderState::set_enabled(GLenum cap, bool on)
+{
+    signed char *slot = cap_slot(cap);
+    if (slot && *slot == (on ? 1 : 0)) return;
+    if (on) glEnable(cap);
+    else glDisable(cap);
+    if (slot) *slot = on ? 1 : 0;
+}
+
+bool RenderState::is_enabled(GLenum cap)
+{
+    signed char *slot = cap_slot(cap);
+    if (!slot || *slot < 0) return glIsEnabled(cap);
+    return *slot == 1;
+}
+
+void RenderState::vertex_attrib(GLuint ix, GLuint buffer, GLint size, GLenum type, GLsizei stride, const void *offset)
+{
+    if (ix >= (GLuint)max_attribs)
+    {
+        bind_array_buffer(buffer);
+        glEnableVertexAttribArray(ix);
+        glVertexAttribPointer(ix, size, type, GL_FALSE, stride, offset);
+        return;
+    }
+
+    Attrib &a = attribs[ix];
+    if (!a.enabled)
+    {
+        glEnableVertexAttribArray(ix);
+        a.enabled = true;
+    }
+    if (a.buffer == buffer && a.size == size && a.type == type && a.stride == stride && a.offset == offset) return;
+    bind_array_buffer(buffer);
+    glVertexAttribPointer(ix, size, type, GL_FALSE, stride, offset);
+    a.buffer = buffer;
+    a.size = size;
+    a.type = type;
+    a.stride = stride;
+    a.offset = offset;
+}
+
+void RenderState::delete_program(GLuint prog)
+{
+    glDeleteProgram(prog);
+    if (program == prog) program = unknown;
+}
+
+void RenderState::delete_buffer(GLuint buffer)
+{
+    glDeleteBuffers(1, &buffer);
+    if (array_buffer == buffer) array_buffer = unknown;
+    for (int i = 0; i < max_attribs; ++i)
+        if (attribs[i].buffer == buffer) attribs[i].buffer = unknown;
+}
+
+void RenderState::delete_texture(GLuint tex)
+{
+    glDeleteTextures(1, &tex);
+    for (int i = 0; i < max_texture_units; ++i)
+        if (textures[i] == tex) textures[i] = unknown;
+}
+
+void RenderState::delete_framebuffer(GLuint fbo)
+{
+    glDeleteFramebuffers(1, &fbo);
+    if (framebuffer == fbo) framebuffer = unknown;
+}
+
+void ProgramUniforms::reset(GLuint prog)
+{
+    this->prog = prog;
+    uniforms.clear();
+    if (prog == 0) return;
+
+    GLint count = 0, max_len = 0;
+    glGetProgramiv(prog, GL_ACTIVE_UNIFORMS, &count);
+    glGetProgramiv(prog, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_len);
+    std::vector<char> name(max_len > 0 ? max_len : 1);
+    for (GLint i = 0; i < count; ++i)
+    {
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(prog, i, name.size(), nullptr, &size, &type, &name[0]);
+        Uniform u;
+        u.name.assign(&name[0]);
+        // Arrays are reported as "name[0]"
+        size_t bracket = u.name.find('[');
+        if (bracket != std::string::npos) u.name.resize(bracket);
+        u.loc = glGetUniformLocation(prog, u.name.c_str());
+        u.type = type;
+        u.count = size;
+        u.known = false;
+        uniforms.push_back(u);
+    }
+}
+
+int ProgramUniforms::find(const char *name) const
+{
+    for (size_t i = 0; i < uniforms.size(); ++i)
+        if (uniforms[i].name == name && uniforms[i].loc >= 0) return i;
+    return -1;
+}
+
+bool ProgramUniforms::changed(int ix, const GLfloat *vals, int n)
+{
+    Uniform &u = uniforms[ix];
+    if (u.known && memcmp(u.vals, vals, n * sizeof(GLfloat)) == 0) return false;
+    memcpy(u.vals, vals, n * sizeof(GLfloat));
+    u.known = true;
+    return true;
+}
+
+void ProgramUniforms::set(int ix, GLfloat x)
+{
+    if (ix < 0 || !changed(ix, &x, 1)) return;
+    glUniform1f(uniforms[ix].loc, x);
+}
+
+void ProgramUniforms::set(int ix, GLfloat x, GLfloat y)
+{
+    GLfloat vals[] = {x, y};
+    if (ix < 0 || !changed(ix, vals, 2)) return;
+    glUniform2f(uniforms[ix].loc, x, y);
+}
+
+void ProgramUniforms::set(int ix, GLfloat x, GLfloat y, GLfloat z)
+{
+    GLfloat vals[] = {x, y, z};
+    if (ix < 0 || !changed(ix, vals, 3)) return;
+    glUniform3f(uniforms[ix].loc, x, y, z);
+}
+
+void ProgramUniforms::set_int(int ix, GLint x)
+{
+    GLfloat val = (GLfloat)x;
+    if (ix < 0 || !changed(ix, &val, 1)) return;
+    glUniform1i(uniforms[ix].loc, x);
+}
+
+void ProgramUniforms::set_mat4(int ix, const GLfloat *vals)
+{
+    if (ix < 0 || !changed(ix, vals, 16)) return;
+    glUniformMatrix4fv(uniforms[ix].loc, 1, GL_FALSE, vals);
+}
+
+bool ProgramUniforms::set_floats(int ix, const GLfloat *vals, int n)
+{
+    if (ix < 0) return false;
+    const Uniform &u = uniforms[ix];
+    int comps = u.type == GL_FLOAT ? 1 : u.type == GL_FLOAT_VEC2 ? 2 : u.type == GL_FLOAT_VEC3 ? 3 : u.type == GL_FLOAT_VEC4 ? 4 : 0;
+    // Whole elements only, and no more than the shadow copy holds
+    if (comps == 0 || n <= 0 || n % comps != 0 || n > comps * u.count || n > 16) return false;
+    if (!changed(ix, vals, n)) return true;
+    if (comps == 1) glUniform1fv(u.loc, n, vals);
+    else if (comps == 2) glUniform2fv(u.loc, n / 2, vals);
+    else if (comps == 3) glUniform3fv(u.loc, n / 3, vals);
+    else glUniform4fv(u.loc, n / 4, vals);
+    return true;
+}
@@ -0,0 +1,106 @@
+#ifndef RENDER_STATE_H
+#define RENDER_STATE_H
+
+#include <GLES2/gl2.h>
+#include <string>
+#include <vector>
+
+// Shadow of the GL state the render loops set, so per-frame calls that change nothing never
+// reach the driver. Everything drawing on the render context goes through render_state;
+// call invalidate() if something may have changed GL state behind its back.
+// Deleting a program or buffer must go through here too, as GL hands out the name again.
+class RenderState
+{
+  public:
+    static const int max_texture_units = 4;
+
+  private:
+    static const GLuint unknown = (GLuint)-1;
+    static const int max_attribs = 4;
+
+    struct Attrib
+    {
+        bool enabled;
+        GLuint buffer;
+        GLint size;
+        GLenum type;
+        GLsizei stride;
+        const void *offset;
+    };
+
+    GLuint program;
+    GLuint array_buffer;
+    GLuint framebuffer;
+    GLuint textures[max_texture_units];
+    GLenum active_unit;
+    GLint vp[4];
+    // -1 unknown, 0 disabled, 1 enabled
+    signed char blend;
+    signed char depth_test;
+    Attrib attribs[max_attribs];
+
+  private:
+    signed char *cap_slot(GLenum cap);
+
+  public:
+    RenderState() { invalidate(); }
+    void invalidate();
+    void use_program(GLuint prog);
+    // For save and restore; restoring a program that was never set does nothing
+    GLuint current_program() const { return program; }
+    void bind_array_buffer(GLuint buffer);
+    void bind_framebuffer(GLuint fbo);
+    // 2D texture on one of the first max_texture_units units
+    void bind_texture(GLuint tex, int unit = 0);
+    void viewport(GLint x, GLint y, GLsizei w, GLsizei h);
+    // GL_BLEND or GL_DEPTH_TEST
+    void set_enabled(GLenum cap, bool on);
+    bool is_enabled(GLenum cap);
+    // Enables the attribute and points it into buffer; binds buffer if it has to re-point
+    void vertex_attrib(GLuint ix, GLuint buffer, GLint size, GLenum type, GLsizei stride = 0, const void *offset = nullptr);
+    void delete_program(GLuint prog);
+    void delete_buffer(GLuint buffer);
+    void delete_texture(GLuint tex);
+    void delete_framebuffer(GLuint fbo);
+};
+
+extern RenderState render_state;
+
+// Active uniforms of one linked program, found with glGetActiveUniform, and the values last
+// set through here. Setters skip the GL call if the value is unchanged; they expect the
+// program to be current.
+class ProgramUniforms
+{
+  private:
+    struct Uniform
+    {
+        std::string name;
+        GLint loc;
+        GLenum type;
+        GLint count;
+        bool known;
+        GLfloat vals[16];
+    };
+
+    GLuint prog = 0;
+    std::vector<Uniform> uniforms;
+
+  private:
+    bool changed(int ix, const GLfloat *vals, int n);
+
+  public:
+    ProgramUniforms(GLuint prog = 0) { reset(prog); }
+    // Forget everything and introspect another program (0 for none)
+    void reset(GLuint prog);
+    // Handle for set(), or -1 if the program has no such active uniform; set() ignores -1
+    int find(const char *name) const;
+    void set(int ix, GLfloat x);
+    void set(int ix, GLfloat x, GLfloat y);
+    void set(int ix, GLfloat x, GLfloat y, GLfloat z);
+    void set_int(int ix, GLint x);
+    void set_mat4(int ix, const GLfloat *vals);
+    // Float, vector or array of them, whichever the shader declared; false if n doesn't fit
+    bool set_floats(int ix, const GLfloat *vals, int n);
+};
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef SHANAT_UNIFORMS_H
+#define SHANAT_UNIFORMS_H
+
+/*
+ * Shared-memory uniform channel: other local processes (MIDI bridges, sequencers, the editor)
+ * set named float uniforms that shanat-live picks up every frame. Plain C, header only, so a
+ * controller only needs this file; link with -lrt on older glibc.
+ *
+ * The segment holds up to SHANAT_UNIFORMS_MAX slots of a name and 1 to 16 floats, guarded by
+ * a seqlock: the render loop copies the block without locks or syscalls and retries if a
+ * writer was busy. Writers take a spinlock among themselves, so any number of them can share
+ * the segment; one that dies holding the lock is detected by pid and the lock is taken over.
+ *
+ *     ShanatUniforms *u = shanat_uniforms_open(SHANAT_UNIFORMS_DEFAULT_NAME, 0);
+ *     float color[3] = {1, 0.5f, 0};
+ *     shanat_uniforms_set(u, "u_color", color, 3);
+ *
+ * Several values written between shanat_uniforms_lock() and shanat_uniforms_unlock() with
+ * shanat_uniforms_put() reach the same frame together.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SHANAT_UNIFORMS_DEFAULT_NAME "/shanat-uniforms"
+#define SHANAT_UNIFORMS_MAGIC 0x554e4853u /* "SHNU" */
+#define SHANAT_UNIFORMS_VERSION 1u
+#define SHANAT_UNIFORMS_MAX 64
+#define SHANAT_UNIFORM_NAME_LEN 32
+#define SHANAT_UNIFORM_MAX_FLOATS 16
+
+typedef struct
+{
+    /* NUL-terminated; empty for a free slot */
+    char name[SHANAT_UNIFORM_NAME_LEN];
+    uint32_t n;
+    float vals[SHANAT_UNIFORM_MAX_FLOATS];
+} ShanatUniformSlot;
+
+/* What readers copy out: slots [0, count) are in use */
+typedef struct
+{
+    uint32_t count;
+    ShanatUniformSlot slots[SHANAT_UNIFORMS_MAX];
+} ShanatUniformData;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    /* Odd while a writer is changing data */
+    uint32_t seq;
+    /* Pid of the writer holding the lock, or 0 */
+    int32_t writer;
+    ShanatUniformData data;
+} ShanatUniforms;
+
+/* Maps the segment, creating it if asked; NULL with errno set on failure */
+static inline ShanatUniforms *shanat_uniforms_open(const char *name, int create)
+{
+    int fd = shm_open(name, O_RDWR | (create ? O_CREAT : 0), 0666);
+    if (fd < 0) return NULL;
+    struct stat st;
+    int ok = fstat(fd, &st) == 0;
+    if (ok && st.st_size < (off_t)sizeof(ShanatUniforms))
+    {
+        /* Too small and not ours to size: not a segment we know */
+        ok = create && ftruncate(fd, sizeof(ShanatUniforms)) == 0;
+        if (!create) errno = EPROTO;
+    }
+    if (!ok)
+    {
+        close(fd);
+        return NULL;
+    }
+    void *mem = mmap(NULL, sizeof(ShanatUniforms), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) return NULL;
+
+    ShanatUniforms *u = (ShanatUniforms *)mem;
+    /* A new segment is all zeros, which is already an empty block */
+    if (create && __atomic_load_n(&u->magic, __ATOMIC_ACQUIRE) == 0)
+    {
+        u->version = SHANAT_UNIFORMS_VERSION;
+        __atomic_store_n(&u->magic, SHANAT_UNIFORMS_MAGIC, __ATOMIC_RELEASE);
+    }
+    if (__atomic_load_n(&u->magic, __ATOMIC_ACQUIRE) != SHANAT_UNIFORMS_MAGIC || u->version != SHANAT_UNIFORMS_VERSION)
+    {
+        munmap(mem, sizeof(ShanatUniforms));
+        errno = EPROTO;
+        return NULL;
+    }
+    return u;
+}
+
+static inline void shanat_uniforms_close(ShanatUniforms *u)
+{
+    if (u) munmap(u, sizeof(ShanatUniforms));
+}
+
+/* Sequence number of the last complete write; cheap enough to poll every frame */
+static inline uint32_t shanat_uniforms_seq(const ShanatUniforms *u)
+{
+    return __atomic_load_n(&u->seq, __ATOMIC_ACQUIRE) & ~1u;
+}
+
+/* Copies a consistent snapshot into out; 0 if writers kept it busy through every attempt */
+static inline int shanat_uniforms_read(const ShanatUniforms *u, ShanatUniformData *out, uint32_t *seq)
+{
+    for (int attempt = 0; attempt < 8; ++attempt)
+    {
+        uint32_t before = __atomic_load_n(&u->seq, __ATOMIC_ACQUIRE);
+        if (before & 1u) continue;
+        memcpy(out, (const void *)&u->data, sizeof(*out));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&u->seq, __ATOMIC_RELAXED) != before) continue;
+        if (out->count > SHANAT_UNIFORMS_MAX) out->count = SHANAT_UNIFORMS_MAX;
+        if (seq) *seq = before;
+        return 1;
+    }
+    return 0;
+}
+
+static inline void shanat_uniforms_lock(ShanatUniforms *u)
+{
+    int32_t self = (int32_t)getpid();
+    for (unsigned spins = 1;; ++spins)
+    {
+        int32_t holder = 0;
+        if (__atomic_compare_exchange_n(&u->writer, &holder, self, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) break;
+        /* Take over from a writer that died with the lock */
+        if (spins % 1024 == 0 && kill(holder, 0) != 0 && errno == ESRCH &&
+            __atomic_compare_exchange_n(&u->writer, &holder, self, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+        sched_yield();
+    }
+    /* Odd tells readers to retry. It may be odd already, left behind by a dead writer. */
+    uint32_t seq = __atomic_load_n(&u->seq, __ATOMIC_RELAXED);
+    if (!(seq & 1u)) __atomic_store_n(&u->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void shanat_uniforms_unlock(ShanatUniforms *u)
+{
+    __atomic_store_n(&u->seq, __atomic_load_n(&u->seq, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&u->writer, 0, __ATOMIC_RELEASE);
+}
+
+/* Under the lock: sets or adds a value; 0 if the name or count don't fit or the block is full */
+static inline int shanat_uniforms_put(ShanatUniforms *u, const char *name, const float *vals, int n)
+{
+    size_t len = strlen(name);
+    if (len == 0 || len >= SHANAT_UNIFORM_NAME_LEN || n < 1 || n > SHANAT_UNIFORM_MAX_FLOATS) return 0;
+    ShanatUniformData *d = &u->data;
+    uint32_t i = 0;
+    while (i < d->count && strcmp(d->slots[i].name, name) != 0) ++i;
+    if (i == SHANAT_UNIFORMS_MAX) return 0;
+    ShanatUniformSlot *slot = &d->slots[i];
+    if (i == d->count)
+    {
+        memset(slot, 0, sizeof(*slot));
+        memcpy(slot->name, name, len);
+        ++d->count;
+    }
+    slot->n = (uint32_t)n;
+    memcpy(slot->vals, vals, n * sizeof(float));
+    return 1;
+}
+
+static inline int shanat_uniforms_set(ShanatUniforms *u, const char *name, const float *vals, int n)
+{
+    shanat_uniforms_lock(u);
+    int ok = shanat_uniforms_put(u, name, vals, n);
+    shanat_uniforms_unlock(u);
+    return ok;
+}
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+// Vector instructions for the math kernels, picked at compile time: SSE on x86, NEON on ARM
+// (on the Pi's 32-bit OS only with -mfpu=neon, see build-live.sh). Define SHANAT_NO_SIMD to
+// build the scalar fallback anyway, e.g. to compare the two.
+#if !defined(SHANAT_NO_SIMD) && defined(__SSE__)
+#define SHANAT_SSE 1
+#include <xmmintrin.h>
+#elif !defined(SHANAT_NO_SIMD) && defined(__ARM_NEON)
+#define SHANAT_NEON 1
+#include <arm_neon.h>
+#endif
+
+#endif
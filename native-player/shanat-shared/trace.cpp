@@ -0,0 +1,122 @@
+#include "trace.h"
+#include "fps.h"
+
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+bool trace_enabled = false;
+
+// Per thread; the oldest events are overwritten once the ring is full
+static const uint32_t ring_size = 1 << 16;
+
+struct TraceEvent
+{
+    const char *name;
+    int64_t start;
+    int64_t dur;
+};
+
+struct ThreadRing
+{
+    long tid;
+    std::string thread_name;
+    TraceEvent events[ring_size];
+    std::atomic<uint32_t> count;
+};
+
+static std::string trace_path;
+static std::mutex rings_mutex;
+static std::vector<ThreadRing *> rings;
+static thread_local ThreadRing *my_ring = nullptr;
+
+static ThreadRing *get_ring()
+{
+    if (my_ring) return my_ring;
+    my_ring = new ThreadRing();
+    my_ring->tid = syscall(SYS_gettid);
+    my_ring->count = 0;
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    rings.push_back(my_ring);
+    return my_ring;
+}
+
+void trace_start(const char *path)
+{
+    trace_path = path;
+    trace_enabled = true;
+}
+
+void trace_thread_name(const char *name)
+{
+    if (!trace_enabled) return;
+    get_ring()->thread_name = name;
+}
+
+void trace_record(const char *name, int64_t start_usec, int64_t dur_usec)
+{
+    if (!trace_enabled) return;
+    ThreadRing *ring = get_ring();
+    uint32_t ix = ring->count.load(std::memory_order_relaxed);
+    TraceEvent &ev = ring->events[ix % ring_size];
+    ev.name = name;
+    ev.start = start_usec;
+    ev.dur = dur_usec;
+    ring->count.store(ix + 1, std::memory_order_release);
+}
+
+void trace_stop()
+{
+    if (!trace_enabled) return;
+    trace_enabled = false;
+
+    FILE *f = fopen(trace_path.c_str(), "wb");
+    if (!f)
+    {
+        fprintf(stderr, "Failed to write trace file '%s'\n", trace_path.c_str());
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+    long pid = getpid();
+    size_t n_events = 0;
+    for (ThreadRing *ring : rings)
+    {
+        if (!ring->thread_name.empty())
+        {
+            fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,\"tid\":%ld,\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",\n", pid, ring->tid, ring->thread_name.c_str());
+            first = false;
+        }
+        uint32_t count = ring->count.load(std::memory_order_acquire);
+        uint32_t begin = count > ring_size ? count - ring_size : 0;
+        for (uint32_t i = begin; i < count; ++i)
+        {
+            const TraceEvent &ev = ring->events[i % ring_size];
+            fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,\"pid\":%ld,\"tid\":%ld}",
+                    first ? "" : ",\n", ev.name, (long long)ev.start, (long long)ev.dur, pid, ring->tid);
+            first = false;
+        }
+        n_events += count - begin;
+    }
+    fprintf(f, "\n]}\n");
+    fclose(f);
+    printf("Wrote %zu trace events to %s\n", n_events, trace_path.c_str());
+}
+
+TraceScope::TraceScope(const char *name)
+    : name(name)
+    , start(trace_enabled ? monotonic_usec() : -1)
+{
+}
+
+TraceScope::~TraceScope()
+{
+    if (start >= 0) trace_record(name, start, monotonic_usec() - start);
+}
@@ -0,0 +1,42 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+// Timeline of scoped spans, written in Chrome's trace-event format (open in Perfetto).
+// Each thread records into its own fixed-size ring, so recording takes no locks.
+// With tracing off at runtime a scope costs one branch; build with -DSHANAT_NO_TRACE
+// to remove the scopes entirely.
+
+extern bool trace_enabled;
+
+// Starts recording; events are written to the file on trace_stop()
+void trace_start(const char *path);
+// Writes the file. Call after every traced thread has been joined.
+void trace_stop();
+void trace_thread_name(const char *name);
+void trace_record(const char *name, int64_t start_usec, int64_t dur_usec);
+
+class TraceScope
+{
+  private:
+    const char *const name;
+    int64_t start;
+
+  public:
+    TraceScope(const char *name);
+    ~TraceScope();
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#ifndef SHANAT_NO_TRACE
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name) \
+    do                    \
+    {                     \
+    } while (0)
+#endif
+
+#endif
@@ -2,7 +2,7 @@
 
 #include <math.h>
 
-float LissajModel::pts[nAllPts * 4] = {0};
+alignas(16) float LissajModel::pts[nAllPts * 4] = {0};
 
 void LissajModel::updatePoints(float start)
 {
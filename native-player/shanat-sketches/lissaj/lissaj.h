@@ -7,7 +7,9 @@
 struct LissajModel
 {
     static const int nAllPts = 128;
-    static float pts[nAllPts * 4];
+    // transformPoints() takes any alignment, but on 16 bytes its four-float loads never
+    // straddle a cache line
+    alignas(16) static float pts[nAllPts * 4];
     static void updatePoints(float start);
 
     static const int nColors = 3;
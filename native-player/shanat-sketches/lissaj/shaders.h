@@ -5,15 +5,14 @@ constexpr const char *lissaj_vert = R"(
 precision mediump float;
 
 attribute vec4 position;
-uniform mat4 proj;
-uniform mat4 view;
+// proj * view, multiplied once per frame on the CPU instead of per point here
+uniform mat4 view_proj;
 varying float ofs;
 
 void main() {
 
 
-    vec4 mvPosition = view * vec4(position.xyz, 1.0);
-    gl_Position = proj * mvPosition;
+    gl_Position = view_proj * vec4(position.xyz, 1.0);
     gl_PointSize = 80.0 / pow(gl_Position.z, 1.2);
     ofs = position.w;
 
@@ -1,14 +1,30 @@
+#include "../shanat-shared/arg_parse.h"
 #include "../shanat-shared/fps.h"
+#include "../shanat-shared/frame_stats.h"
 #include "../shanat-shared/geo.h"
+#include "../shanat-shared/gpu_fences.h"
 #include "../shanat-shared/horrors.h"
+#include "../shanat-shared/horrors_args.h"
+#include "../shanat-shared/offline.h"
+#include "../shanat-shared/profiler.h"
+#include "../shanat-shared/program_cache.h"
+#include "../shanat-shared/render_state.h"
+#include "../shanat-shared/trace.h"
 
 #include "lissaj/lissaj.h"
 
 #include <csignal>
 #include <cstdio>
+#include <cstdlib>
 #include <math.h>
+#include <memory>
+#include <string>
 
-static const char *devicePath = "/dev/dri/card0";
+static HorrorsOptions horrors_opts;
+static OfflineOptions offline_opts;
+static std::string stats_target;
+static std::string trace_file;
+static std::string cache_dir = ProgramCache::default_dir();
 
 static bool running = true;
 
@@ -17,8 +33,40 @@ static void sighandler(int)
     running = false;
 }
 
+static void parse_args(int argc, const char *argv[])
+{
+    auto parser = ArgumentParser("shanat-sketches");
+    parser.add_argument("help", "--help", "", "Displays this help message");
+    add_horrors_arguments(parser);
+    add_offline_arguments(parser);
+    parser.add_argument("stats", "--stats", "", "Publish frame stats as JSON to a file or unix:/socket/path", STORE);
+    parser.add_argument("trace", "--trace", "", "Record a timeline in Chrome trace-event JSON to this file", STORE);
+    parser.add_argument("cache", "--cache", "", "Program binary cache directory, or 'off' (default: ~/.cache/shanat)", STORE);
+
+    bool success = parser.parse(argv, argc, stdout);
+    if (!success || parser.get("help").is_set)
+    {
+        parser.print_usage(stdout);
+        exit(success ? 0 : 1);
+    }
+
+    if (parser.get("stats").is_set) stats_target = parser.get("stats").value;
+    if (parser.get("trace").is_set) trace_file = parser.get("trace").value;
+    if (parser.get("cache").is_set) cache_dir = parser.get("cache").value;
+    if (cache_dir == "off") cache_dir.clear();
+
+    bool ok = read_horrors_arguments(parser, horrors_opts);
+    ok &= read_offline_arguments(parser, offline_opts);
+    if (!ok)
+    {
+        parser.print_usage(stdout);
+        exit(1);
+    }
+}
+
 static GLuint compile_shader(GLenum type, const char *src)
 {
+    TRACE_SCOPE("compile_shader");
     GLuint s = glCreateShader(type);
     glShaderSource(s, 1, &src, nullptr);
     glCompileShader(s);
@@ -50,62 +98,92 @@ static void report_shader_link_error(GLuint prog)
     exit_with_cleanup(1);
 }
 
-int main()
+int main(int argc, const char *argv[])
 {
+    parse_args(argc, argv);
+
     signal(SIGINT, sighandler);
     signal(SIGTERM, sighandler);
 
-    init_horrors(devicePath);
+    if (!trace_file.empty()) trace_start(trace_file.c_str());
+    trace_thread_name("render");
+
+    init_horrors(horrors_opts);
     FPS fps(25);
+    fps.set_vblank_source(get_vblank_timing);
+    std::unique_ptr<FrameStats> stats(new FrameStats(stats_target));
+    fps.set_stats(stats.get());
 
-    // Compile shaders, link program
-    GLuint vs = compile_shader(GL_VERTEX_SHADER, lissaj_vert);
-    GLuint fs = compile_shader(GL_FRAGMENT_SHADER, lissaj_frag);
-    GLuint prog = glCreateProgram();
-    glAttachShader(prog, vs);
-    glAttachShader(prog, fs);
+    // Restore program from the cache, or compile shaders and link
     const GLint ixPosAttribute = 0;
-    glBindAttribLocation(prog, ixPosAttribute, "a_pos");
-    glLinkProgram(prog);
-    GLint ok = 0;
-    glGetProgramiv(prog, GL_LINK_STATUS, &ok);
-    if (!ok) report_shader_link_error(prog);
-    glUseProgram(prog);
+    ProgramCache program_cache(cache_dir);
+    GLuint prog = program_cache.load(lissaj_vert, lissaj_frag);
+    if (prog == 0)
+    {
+        GLuint vs = compile_shader(GL_VERTEX_SHADER, lissaj_vert);
+        GLuint fs = compile_shader(GL_FRAGMENT_SHADER, lissaj_frag);
+        prog = glCreateProgram();
+        glAttachShader(prog, vs);
+        glAttachShader(prog, fs);
+        glBindAttribLocation(prog, ixPosAttribute, "a_pos");
+        GLint ok = 0;
+        {
+            TRACE_SCOPE("link_program");
+            glLinkProgram(prog);
+            glGetProgramiv(prog, GL_LINK_STATUS, &ok);
+        }
+        if (!ok) report_shader_link_error(prog);
+        glDeleteShader(vs);
+        glDeleteShader(fs);
+        program_cache.store(prog, lissaj_vert, lissaj_frag);
+    }
+    render_state.use_program(prog);
 
     // OpenGL fidgeting
-    glEnable(GL_BLEND);
+    render_state.set_enabled(GL_BLEND, true);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    glEnable(GL_DEPTH_TEST);
+    render_state.set_enabled(GL_DEPTH_TEST, true);
     glDepthFunc(GL_LESS);
+    glClearColor(0, 0, 0, 1);
+
+    // Frame completion tracking without stalling on glFinish
+    GpuFences fences;
 
-    // Buffer the shader will be outputting to
+    // Buffer the shader will be outputting to; points change every frame, layout doesn't
     GLuint vbo;
     glGenBuffers(1, &vbo);
+    render_state.vertex_attrib(ixPosAttribute, vbo, 4, GL_FLOAT);
 
     // Non-boilerplate
     // ===================================================
 
     // Initialize model
     LissajModel::initColors();
-    Mat4 proj, view;
-    perspective(50, (float)mode.hdisplay / (float)mode.vdisplay, 0.1, 100, proj);
+    Mat4 proj, view, viewProj;
+    perspective(50, (float)surface_width / (float)surface_height, 0.1, 100, proj);
     const float camDist = 3;
     Vec3 camPosition, target, up;
     target.set(0, 0, 0);
     up.set(0, 1, 0);
 
-    // Get uniform locations
-    GLint time_loc = glGetUniformLocation(prog, "time");
-    GLint resolution_loc = glGetUniformLocation(prog, "resolution");
-    GLint clr_loc = glGetUniformLocation(prog, "clr");
-    GLint view_loc = glGetUniformLocation(prog, "view");
-    GLint proj_loc = glGetUniformLocation(prog, "proj");
+    // Uniforms of the program
+    ProgramUniforms uniforms(prog);
+    int time_ix = uniforms.find("time");
+    int resolution_ix = uniforms.find("resolution");
+    int clr_ix = uniforms.find("clr");
+    int view_proj_ix = uniforms.find("view_proj");
     // ===================================================
 
+    // Fixed timestep into FBOs read back in the background, instead of paced by the display
+    std::unique_ptr<OfflineRenderer> offline;
+    if (offline_opts.frames > 0) offline.reset(new OfflineRenderer(offline_opts, surface_width, surface_height));
+
     while (running)
     {
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        float current_time = fps.frame_start();
+        TRACE_SCOPE("frame");
+        float current_time;
+        if (!offline) current_time = fps.frame_start();
+        else if (!offline->next_frame(current_time)) break;
 
         // Non-boilerplate
         // ===================================================
@@ -117,35 +195,54 @@ int main()
             2,
             camDist * cos(camAngle));
         lookAt(camPosition, target, up, view);
+        multiply(proj, view, viewProj);
 
         // Set uniforms
-        glUniform1f(time_loc, current_time);
-        glUniform2f(resolution_loc, (float)mode.hdisplay, (float)mode.vdisplay);
-        float clrR, clrG, clrB;
-        LissajModel::getColor(clrR, clrG, clrB);
-        glUniform3f(clr_loc, clrR, clrG, clrB);
-        glUniformMatrix4fv(view_loc, 1, GL_FALSE, view.vals);
-        glUniformMatrix4fv(proj_loc, 1, GL_FALSE, proj.vals);
-
-        glBufferData(GL_ARRAY_BUFFER, sizeof(LissajModel::pts), LissajModel::pts, GL_STATIC_DRAW);
-        glEnableVertexAttribArray(ixPosAttribute);
-        glVertexAttribPointer(ixPosAttribute, 4, GL_FLOAT, GL_FALSE, 0, 0);
-        // ===================================================
-
-        glViewport(0, 0, mode.hdisplay, mode.vdisplay);
-        glClearColor(0, 0, 0, 1);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glDrawArrays(GL_POINTS, 0, LissajModel::nAllPts);
-        glFinish();
-
+        {
+            ProfScope prof(PROF_UNIFORMS);
+            uniforms.set(time_ix, current_time);
+            uniforms.set(resolution_ix, (float)surface_width, (float)surface_height);
+            float clrR, clrG, clrB;
+            LissajModel::getColor(clrR, clrG, clrB);
+            uniforms.set(clr_ix, clrR, clrG, clrB);
+            uniforms.set_mat4(view_proj_ix, viewProj.vals);
+        }
+
+        {
+            ProfScope prof(PROF_DRAW);
+            render_state.bind_array_buffer(vbo);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(LissajModel::pts), LissajModel::pts, GL_STREAM_DRAW);
+            // ===================================================
+
+            render_state.bind_framebuffer(offline ? offline->framebuffer() : default_fbo);
+            render_state.viewport(0, 0, surface_width, surface_height);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            glDrawArrays(GL_POINTS, 0, LissajModel::nAllPts);
+        }
+        if (offline)
+        {
+            offline->frame_done();
+            continue;
+        }
+        fences.frame_submitted();
+
+        fences.check();
         put_on_screen();
 
+        fences.wait_until(fps.get_next_slot());
         fps.frame_end();
     }
 
-    glDeleteBuffers(1, &vbo);
+    if (offline) offline->finish();
+    offline.reset();
+    render_state.delete_buffer(vbo);
+    render_state.delete_program(prog);
 
     printf("\nGoodbye!\n");
     cleanup_horrors();
+
+    // Stats thread must be gone before the trace is written
+    stats.reset();
+    trace_stop();
     return 0;
 }
@@ -0,0 +1,104 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include "../shanat-shared/shanat_uniforms.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void print_usage(FILE *f)
+{
+    fprintf(f, "Usage: shanat-uniform [--shm NAME] UNIFORM X [Y..] [UNIFORM X [Y..]]...\n"
+               "       shanat-uniform [--shm NAME] --list\n\n"
+               "Sets float uniforms in shanat-live's shared-memory channel (default: %s).\n"
+               "Values given together reach the same frame.\n",
+            SHANAT_UNIFORMS_DEFAULT_NAME);
+}
+
+static int is_number(const char *s, float *val)
+{
+    char *end;
+    *val = strtof(s, &end);
+    return end != s && *end == 0;
+}
+
+static void list(const ShanatUniforms *u)
+{
+    ShanatUniformData data;
+    if (!shanat_uniforms_read(u, &data, NULL))
+    {
+        fprintf(stderr, "Writers kept the channel busy; try again\n");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < data.count; ++i)
+    {
+        const ShanatUniformSlot *slot = &data.slots[i];
+        printf("%s", slot->name);
+        for (uint32_t j = 0; j < slot->n && j < SHANAT_UNIFORM_MAX_FLOATS; ++j) printf(" %g", slot->vals[j]);
+        printf("\n");
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const char *shm_name = SHANAT_UNIFORMS_DEFAULT_NAME;
+    int do_list = 0;
+    int first = 1;
+    for (; first < argc && argv[first][0] == '-' && argv[first][1] == '-'; ++first)
+    {
+        if (strcmp(argv[first], "--shm") == 0 && first + 1 < argc) shm_name = argv[++first];
+        else if (strcmp(argv[first], "--list") == 0) do_list = 1;
+        else
+        {
+            print_usage(strcmp(argv[first], "--help") == 0 ? stdout : stderr);
+            return strcmp(argv[first], "--help") == 0 ? 0 : 1;
+        }
+    }
+    if (!do_list && first == argc)
+    {
+        print_usage(stderr);
+        return 1;
+    }
+
+    ShanatUniforms *u = shanat_uniforms_open(shm_name, 0);
+    if (!u)
+    {
+        fprintf(stderr, "Cannot open uniform channel '%s': %s; is shanat-live running with --uniforms?\n", shm_name,
+                strerror(errno));
+        return 1;
+    }
+    if (do_list)
+    {
+        list(u);
+        shanat_uniforms_close(u);
+        return 0;
+    }
+
+    // Check everything first, so a typo doesn't leave half the values set
+    float vals[SHANAT_UNIFORM_MAX_FLOATS];
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        if (pass == 1) shanat_uniforms_lock(u);
+        for (int i = first; i < argc;)
+        {
+            const char *name = argv[i++];
+            int n = 0;
+            while (i < argc && n < SHANAT_UNIFORM_MAX_FLOATS && is_number(argv[i], &vals[n])) ++n, ++i;
+            if (pass == 1)
+            {
+                if (!shanat_uniforms_put(u, name, vals, n)) fprintf(stderr, "No room left for '%s'\n", name);
+                continue;
+            }
+            if (n == 0 || is_number(name, &vals[0]) || strlen(name) >= SHANAT_UNIFORM_NAME_LEN)
+            {
+                fprintf(stderr, "Expected a uniform name followed by 1 to %d numbers at '%s'\n",
+                        SHANAT_UNIFORM_MAX_FLOATS, name);
+                shanat_uniforms_close(u);
+                return 1;
+            }
+        }
+    }
+    shanat_uniforms_unlock(u);
+    shanat_uniforms_close(u);
+    return 0;
+}
@@ -5,6 +5,7 @@ import {WebSocketServer} from "ws";
 import cors from "cors";
 import {join} from "path";
 import {createReadStream} from "fs";
+import * as net from "net";
 import {writeFile} from "fs/promises";
 import * as path from "path";
 import {truncate} from "../src-common/utils.js";
@@ -15,6 +16,8 @@ const publicDir = path.join(process.cwd(), "public");
 const shaderFileName = "frag.glsl";
 const defaultShaderDir = "../data";
 const shaderDirEnvVar = "SHADER_DIR";
+const controlEnvVar = "SHANAT_CONTROL";
+const controlTimeoutMsec = 5000;
 
 let shaderDir = defaultShaderDir;
 if (process.env[shaderDirEnvVar]) {
@@ -22,6 +25,10 @@ if (process.env[shaderDirEnvVar]) {
 }
 console.log(`Using shader directory: ${shaderDir}`);
 
+// shanat-live's control socket: a unix socket path, or a TCP port on localhost
+const controlTarget = process.env[controlEnvVar];
+if (controlTarget) console.log(`Applying sketches through shanat-live's control socket: ${controlTarget}`);
+
 
 let webEditorSocket = null;
 
@@ -173,14 +180,54 @@ async function sckGetSketch(msg) {
 }
 
 
+// Takes what shanat-live's --control does, unix:/path or tcp:PORT, as well as a bare path or port
+function connectControl() {
+  if (controlTarget.startsWith("unix:")) return net.connect(controlTarget.substring("unix:".length));
+  const portStr = controlTarget.startsWith("tcp:") ? controlTarget.substring("tcp:".length) : controlTarget;
+  const port = Number(portStr);
+  return Number.isInteger(port) && portStr !== "" ? net.connect(port, "127.0.0.1") : net.connect(controlTarget);
+}
+
+// Sends one request over shanat-live's control socket; resolves with its JSON reply
+function controlRequest(payload) {
+  return new Promise((resolve, reject) => {
+    const sck = connectControl();
+    let data = Buffer.alloc(0);
+    sck.setTimeout(controlTimeoutMsec, () => sck.destroy(new Error("Timed out waiting for shanat-live")));
+    sck.on("error", reject);
+    sck.on("connect", () => {
+      const body = Buffer.from(payload, "utf-8");
+      const len = Buffer.alloc(4);
+      len.writeUInt32BE(body.length);
+      sck.write(Buffer.concat([len, body]));
+    });
+    sck.on("data", (chunk) => {
+      data = Buffer.concat([data, chunk]);
+      if (data.length < 4 || data.length < 4 + data.readUInt32BE(0)) return;
+      sck.end();
+      resolve(JSON.parse(data.subarray(4, 4 + data.readUInt32BE(0)).toString("utf-8")));
+    });
+  });
+}
+
 async function sckApplySketch(msg) {
 
+  // Still written with the socket in use: it's what shanat-live loads when it next starts
   await storage.mutex.runExclusive(async () => {
     const fn = join(shaderDir, shaderFileName);
     await writeFile(fn, msg.frag, "utf-8");
   });
 
   const resp = { action: PROT.ACTION.ApplySketchResult };
+  if (controlTarget) {
+    try {
+      const res = await controlRequest("apply\n" + msg.frag);
+      if (!res.ok) resp.error = res.log || res.error;
+    }
+    catch (err) {
+      console.error(`Control socket request failed: ${err.message}`);
+    }
+  }
 
   const outStr = JSON.stringify(resp);
   webEditorSocket.send(outStr);